@@ -3,8 +3,9 @@
 
 #pragma once
 
+#include "CC.h"
 #include "Packet.h"
-#include <V2Base.h>
+#include "Time.h"
 
 namespace V2MIDI::File {
 
@@ -170,9 +171,11 @@ namespace V2MIDI::File {
     }
 
   private:
+    friend class Tracks;
+
     // MIDI Running status. Repeated channel messages of the same type and channel might omit
     // the leading status byte.
-    struct {
+    struct Running {
       Packet::Status status;
       uint8_t        channel;
     } _running;
@@ -196,9 +199,54 @@ namespace V2MIDI::File {
 
   // The MIDI file, it contains the tracks.
   class Tracks {
+  private:
+    static constexpr uint16_t _maxTracks{16};
+
   public:
     enum class State { Empty, Loaded, Play, Stop };
 
+    // A pre-decoded event of the merged tracks. The packet's port number carries
+    // the track number. A packet with the 'Reserved' code index is a tempo change,
+    // its bytes 1 to 3 carry the number of microseconds per beat.
+    struct Entry {
+      uint32_t tick;
+      Packet   packet;
+    };
+
+    // A tempo segment, it starts at 'tick' / 'time'. The time is counted in fractions
+    // of microseconds, one tick lasts 'usec' units; the division of the file is one
+    // microsecond.
+    struct Tempo {
+      uint32_t tick;
+      uint64_t time;
+      uint32_t usec;
+    };
+
+    // The last program, controller and pitch bend values of all channels, they
+    // are sent again after a seek.
+    struct Chase {
+      struct {
+        uint8_t track;
+        uint8_t program;
+        uint8_t controllers[7];
+        int16_t pitchbend;
+      } channels[16];
+    };
+
+    // The playback state at a tick. The position of every track is stored before
+    // its pending event, together with the Running Status needed to read it.
+    struct Checkpoint {
+      uint32_t tick;
+      uint32_t entry;
+      Tempo    tempo;
+      Chase    chase;
+      struct {
+        uint32_t       cursor;
+        uint32_t       tick;
+        Track::Running running;
+      } tracks[_maxTracks];
+    };
+
     constexpr Tracks(){};
     constexpr Tracks(const uint8_t* data = NULL) {
       load(data);
@@ -216,6 +264,11 @@ namespace V2MIDI::File {
 
       _state          = State::Empty;
       _data           = data;
+      _index          = {};
+      _tempoMap       = {};
+      _checkpoints    = {};
+      _loop           = {};
+      _notes          = {};
       uint32_t cursor = 0;
 
       if (!readSignature("MThd", cursor))
@@ -247,6 +300,10 @@ namespace V2MIDI::File {
       if (_header.division & 0x8000)
         return false;
 
+      // The time calculations divide by the ticks per beat.
+      if (_header.division == 0)
+        return false;
+
       for (uint16_t i = 0; i < _header.nTracks; i++) {
         if (!readSignature("MTrk", cursor))
           return false;
@@ -297,21 +354,106 @@ namespace V2MIDI::File {
       return _tracks[0].copyTag(meta, text, size);
     }
 
-    bool play() {
+    // The number of entries needed to index the loaded file.
+    uint32_t getIndexSize() {
+      if (_state == State::Empty)
+        return 0;
+
+      return mergeTracks([](uint32_t tick, const Packet& packet) {});
+    }
+
+    // Decode all tracks into a time-sorted array, playback then only reads the
+    // prepared packets. Events at the same tick are ordered by their track number.
+    bool index(Entry* entries, uint32_t size) {
       if (_state == State::Empty)
         return false;
 
-      for (uint8_t i = 0; i < _header.nTracks; i++)
-        _play.tracks[i] = {};
+      if (getIndexSize() > size)
+        return false;
 
-      // The default tempo, if no tempo events are in track 0.
-      setTempoBPM(120);
+      _index.entries = entries;
+      _index.count   = mergeTracks([entries](uint32_t tick, const Packet& packet) mutable {
+        *entries++ = {tick, packet};
+      });
+      return true;
+    }
+
+    // The number of entries needed for the tempo map.
+    uint32_t getTempoMapSize() const {
+      if (_state == State::Empty)
+        return 0;
+
+      return readTempoMap([](const Tempo& tempo) {});
+    }
+
+    // Store the tempo changes of track 0 as a sorted array of segments. The
+    // conversions between ticks and time, and the length of the file, are
+    // then looked up instead of read from the track.
+    bool indexTempo(Tempo* tempos, uint32_t size) {
+      if (_state == State::Empty)
+        return false;
+
+      if (getTempoMapSize() > size)
+        return false;
+
+      _tempoMap.entries = tempos;
+      _tempoMap.count   = readTempoMap([tempos](const Tempo& tempo) mutable {
+        *tempos++ = tempo;
+      });
+      _tempoMap.ticks = readTicks();
+      return true;
+    }
+
+    // The number of ticks until the last event of all tracks.
+    uint32_t getTicks() const {
+      if (_state == State::Empty)
+        return 0;
+
+      if (_tempoMap.entries)
+        return _tempoMap.ticks;
+
+      return readTicks();
+    }
 
-      _play.tick     = 0;
-      _play.lastUsec = V2Base::getUsec();
+    uint64_t getDurationUsec() const {
+      return tickToUsec(getTicks());
+    }
+
+    // The time from the start of the file when a tick is due.
+    uint64_t tickToUsec(uint32_t tick) const {
+      if (_state == State::Empty)
+        return 0;
+
+      const Tempo    tempo = findTempo([tick](const Tempo& t) { return t.tick <= tick; });
+      const uint64_t time  = tempo.time + (uint64_t)(tick - tempo.tick) * tempo.usec;
+      return (time + _header.division - 1) / _header.division;
+    }
+
+    // The tick which is due at a time from the start of the file.
+    uint32_t usecToTick(uint64_t usec) const {
+      if (_state == State::Empty)
+        return 0;
+
+      const uint64_t time  = usec * _header.division;
+      const Tempo    tempo = findTempo([time](const Tempo& t) { return t.time <= time; });
+      return tempo.tick + (time - tempo.time) / tempo.usec;
+    }
+
+    // Start the playback at 'tick'.
+    bool play(uint32_t tick = 0) {
+      if (_state == State::Empty)
+        return false;
+
+      releaseNotes();
+      rewind();
+      _play.lastUsec = Time::getUsec();
 
       _state = State::Play;
       handleStateChange(_state);
+
+      if (tick > 0)
+        seek(tick);
+
       return true;
     }
 
@@ -323,6 +465,106 @@ namespace V2MIDI::File {
       handleStateChange(_state);
     }
 
+    // Store the playback state every 'interval' ticks. A seek restores the closest
+    // checkpoint and reads only the events from there to the target. Returns the
+    // number of checkpoints; if the array is too small, the end of the file is not
+    // covered. It cannot be called during playback.
+    uint32_t indexCheckpoints(Checkpoint* checkpoints, uint32_t size, uint32_t interval) {
+      if (_state == State::Empty || _state == State::Play)
+        return 0;
+
+      if (interval == 0)
+        return 0;
+
+      _checkpoints = {};
+      rewind();
+
+      // Walk the tracks, the index follows the same order.
+      uint32_t n = 0;
+      for (; n < size; n++) {
+        const uint32_t tick = (n + 1) * interval;
+        while (playTracks(tick - 1, false))
+          ;
+
+        if (_play.nQueue == 0)
+          break;
+
+        saveCheckpoint(&checkpoints[n], tick);
+      }
+
+      _checkpoints = {checkpoints, n};
+      return n;
+    }
+
+    // Continue the playback at 'tick'. The sounding notes are released, the last
+    // program, controller and pitch bend values of all channels are sent again.
+    bool seek(uint32_t tick) {
+      if (_state != State::Play)
+        return false;
+
+      releaseNotes();
+      restoreCheckpoint(tick);
+      if (tick > 0) {
+        while (playEvents(tick - 1, false))
+          ;
+      }
+
+      _play.tick = tick;
+      _play.time = getTime(tick);
+      sendChase();
+      return true;
+    }
+
+    // Continue the playback at a time from the start of the file.
+    bool seekUsec(uint64_t usec) {
+      return seek(usecToTick(usec));
+    }
+
+    // Continue the playback at a marker meta event.
+    bool seek(const char* marker) {
+      uint32_t tick;
+      if (!findMarker(marker, tick))
+        return false;
+
+      return seek(tick);
+    }
+
+    // Find the tick of a marker meta event in track 0.
+    bool findMarker(const char* marker, uint32_t& tick) const {
+      if (_state == State::Empty)
+        return false;
+
+      // Do not touch the Running Status of the played track.
+      Track          track  = _tracks[0];
+      uint32_t       cursor = 0;
+      const uint32_t length = strlen(marker);
+
+      tick = 0;
+      for (;;) {
+        Event e;
+        if (!track.readEvent(e, cursor))
+          return false;
+
+        tick += e.delta;
+        if (e.type != Event::Type::Meta || e.metaType != Event::Meta::Marker)
+          continue;
+
+        if (e.length == length && memcmp(e.data, marker, length) == 0)
+          return true;
+      }
+    }
+
+    // Repeat the region from 'start' to 'end', the events at 'end' are not played.
+    // An 'end' not larger than 'start' disables the loop.
+    void setLoop(uint32_t start, uint32_t end) {
+      if (end <= start) {
+        _loop = {};
+        return;
+      }
+
+      _loop = {start, end};
+    }
+
     // This needs to be called from a few times a millisecond to every
     // few milliseconds. The playback speed does not depend on the call
     // frequency, it only affects the accuracy of the events timing.
@@ -331,84 +573,72 @@ namespace V2MIDI::File {
         return;
 
       // Calculate the time since the last run.
-      const uint32_t nowUsec    = V2Base::getUsec();
+      const uint32_t nowUsec    = Time::getUsec();
       const uint32_t passedUsec = (uint32_t)(nowUsec - _play.lastUsec);
       _play.lastUsec            = nowUsec;
 
-      // Add the number of ticks which have passed since the last run.
-      _play.tick += passedUsec / _play.tickDurationUsec;
+      // Advance the clock.
+      _play.time += (uint64_t)passedUsec * _header.division;
 
-      bool playing{};
+      for (;;) {
+        updateTick();
 
-      for (uint8_t i = 0; i < _header.nTracks; i++) {
-        if (_play.tracks[i].end)
+        // Play the events up to the current tick, or to the end of the loop. A tempo
+        // change moves the current tick.
+        const bool     loop  = _loop.end > 0 && _play.tick >= _loop.end;
+        const uint32_t limit = loop ? _loop.end - 1 : _play.tick;
+        if (playEvents(limit, true))
           continue;
 
-        playing = true;
+        if (!loop)
+          break;
 
-        // Check if the current track has pending messages.
-        if (_play.tick < _play.tracks[i].tick)
-          continue;
+        // Jump back and keep the time which has passed after the end of the loop.
+        const uint64_t late = _play.time - getTime(_loop.end);
+        seek(_loop.start);
+        _play.time += late;
+      }
 
-        const Event* e = &_play.tracks[i].event;
-        for (;;) {
-          // Read a new event, or handle the previous / delayed event.
-          if (e->type == Event::Type::None) {
-            if (!_tracks[i].readEvent(_play.tracks[i].event, _play.tracks[i].cursor)) {
-              _play.tracks[i].end = true;
-              break;
-            }
+      if (_loop.end == 0 && !hasEvents()) {
+        _state = State::Stop;
+        handleStateChange(_state);
+      }
+    }
 
-            if (e->delta > 0) {
-              // Delay event.
-              _play.tracks[i].tick += e->delta;
-              break;
-            }
-          }
+    // The number of microseconds until the next event is due; 0 if an event is
+    // already due. Returns false if there are no more events. It can be used to
+    // sleep or to arm a timer instead of calling run() periodically.
+    bool getNextEventUsec(uint32_t& usec) const {
+      if (_state != State::Play)
+        return false;
 
-          // Track 0 might change the global playback tempo.
-          if (i == 0 && e->type == Event::Type::Meta && e->metaType == Event::Meta::Tempo) {
-            // 24 bit integer, the number of microseconds per beat. Updates the global tempo.
-            setTempoUsec(e->data[0] << 16 | e->data[1] << 8 | e->data[2]);
-            _play.tracks[i].event.type = Event::Type::None;
-            continue;
-          }
+      uint32_t tick{};
+      if (!getNextTick(tick)) {
+        if (_loop.end == 0)
+          return false;
 
-          if (e->type == Event::Type::Message) {
-            Packet midi;
+        tick = _loop.end;
+      }
 
-            switch (e->status) {
-              case Packet::Status::NoteOn:
-              case Packet::Status::NoteOff:
-              case Packet::Status::Aftertouch:
-              case Packet::Status::ControlChange:
-              case Packet::Status::PitchBend:
-                handleSend(i, midi.set(e->channel, e->status, e->data[0], e->data[1]));
-                break;
-
-              case Packet::Status::ProgramChange:
-              case Packet::Status::AftertouchChannel:
-                handleSend(i, midi.set(e->channel, e->status, e->data[0]));
-                break;
-            }
-          }
+      if (_loop.end > 0 && tick > _loop.end)
+        tick = _loop.end;
 
-          _play.tracks[i].event.type = Event::Type::None;
-        }
+      if (tick <= _play.tick) {
+        usec = 0;
+        return true;
       }
 
-      if (!playing) {
-        _state = State::Stop;
-        handleStateChange(_state);
-      }
+      const uint64_t time = getTime(tick);
+      usec                = (time - _play.time + _header.division - 1) / _header.division;
+      return true;
     }
 
     // Used if run() is not called periodically from a timer.
     void loop() {
-      if (V2Base::getUsecSince(_usec) < 1000)
+      if (Time::getUsecSince(_usec) < 1000)
         return;
 
-      _usec = V2Base::getUsec();
+      _usec = Time::getUsec();
 
       run();
     }
@@ -423,7 +653,7 @@ namespace V2MIDI::File {
     }
 
   private:
-    static constexpr uint16_t _maxTracks{16};
+    static constexpr uint32_t _defaultTempoUsec{500 * 1000};
     State                     _state{};
     uint32_t                  _usec{};
 
@@ -437,25 +667,497 @@ namespace V2MIDI::File {
     } _header{};
     Track _tracks[_maxTracks]{};
 
+    // The pre-decoded events.
+    struct {
+      const Entry* entries;
+      uint32_t     count;
+    } _index{};
+
+    // The tempo segments, and the length of the file in ticks.
+    struct {
+      const Tempo* entries;
+      uint32_t     count;
+      uint32_t     ticks;
+    } _tempoMap{};
+
+    // The stored playback states.
+    struct {
+      const Checkpoint* entries;
+      uint32_t          count;
+    } _checkpoints{};
+
+    // The looped region.
+    struct {
+      uint32_t start;
+      uint32_t end;
+    } _loop{};
+
+    // The controllers which are sent again after a seek; the bank is selected
+    // before the program change.
+    static constexpr uint8_t _chaseControllers[]{
+      CC::BankSelect,
+      CC::BankSelectLSB,
+      CC::ModulationWheel,
+      CC::ChannelVolume,
+      CC::Pan,
+      CC::Expression,
+      CC::SustainPedal,
+    };
+    static constexpr int16_t _chaseUnset{INT16_MAX};
+
+    // The position of the program change in the list of controllers, it is sent
+    // after the two bank select controllers.
+    static constexpr uint8_t _chaseProgram{2};
+
+    // The sounding notes of all channels, they are released before a jump. The
+    // track which played a note is stored in 4 bits.
+    struct {
+      struct {
+        uint32_t notes[4];
+        uint8_t  tracks[64];
+      } channels[16];
+    } _notes{};
+    static_assert(_maxTracks <= 16, "The track numbers of the notes need to fit into 4 bits");
+
     // The global tempo and track state during playback.
     struct {
-      // The duration of one MIDI tick.
-      float tickDurationUsec{};
+      // The playback time in fractions of microseconds; one tick at a tempo of 'usec'
+      // per beat lasts exactly 'usec' units. Tempo changes are exact and the
+      // conversion to ticks does not drift.
+      uint64_t time{};
+      Tempo    tempo{};
 
       // The current tick while playing the file.
-      float tick{};
+      uint32_t tick{};
 
       // The last time the tick handler was called.
       uint32_t lastUsec{};
 
-      // The played tracks.
+      // The next entry of the index. Without an index, the number of events which
+      // would have been stored in the index.
+      uint32_t entry{};
+
+      // The played tracks. 'start' and 'running' are the state before the pending
+      // event was read.
+      struct {
+        uint32_t       cursor;
+        uint32_t       tick;
+        Event          event;
+        uint32_t       start;
+        Track::Running running;
+      } tracks[_maxTracks];
+
+      // The tracks with pending events; a min-heap ordered by the tick of the next
+      // event, and the track number.
+      uint8_t queue[_maxTracks];
+      uint8_t nQueue;
+
+      Chase chase;
+    } _play{};
+
+    // The channel messages are played, all other events are ignored.
+    static bool readPacket(const Event* e, Packet* midi) {
+      if (e->type != Event::Type::Message)
+        return false;
+
+      switch (e->status) {
+        case Packet::Status::NoteOn:
+        case Packet::Status::NoteOff:
+        case Packet::Status::Aftertouch:
+        case Packet::Status::ControlChange:
+        case Packet::Status::PitchBend:
+          midi->set(e->channel, e->status, e->data[0], e->data[1]);
+          return true;
+
+        case Packet::Status::ProgramChange:
+        case Packet::Status::AftertouchChannel:
+          midi->set(e->channel, e->status, e->data[0]);
+          return true;
+      }
+
+      return false;
+    }
+
+    // Read the events of all tracks in the order of their ticks, and pass the
+    // packets to 'f'. Returns the number of packets.
+    template <typename F> uint32_t mergeTracks(F f) {
       struct {
+        Track    track;
         uint32_t cursor;
-        float    tick;
+        uint32_t tick;
         Event    event;
         bool     end;
       } tracks[_maxTracks];
-    } _play{};
+
+      for (uint8_t i = 0; i < _header.nTracks; i++) {
+        tracks[i].track  = _tracks[i];
+        tracks[i].cursor = 0;
+        tracks[i].tick   = 0;
+        tracks[i].end    = !tracks[i].track.readEvent(tracks[i].event, tracks[i].cursor);
+        tracks[i].tick += tracks[i].event.delta;
+      }
+
+      uint32_t count = 0;
+      for (;;) {
+        // The track with the earliest event.
+        int8_t next = -1;
+        for (uint8_t i = 0; i < _header.nTracks; i++) {
+          if (tracks[i].end)
+            continue;
+
+          if (next < 0 || tracks[i].tick < tracks[next].tick)
+            next = i;
+        }
+
+        if (next < 0)
+          break;
+
+        auto&        t = tracks[next];
+        const Event* e = &t.event;
+        Packet       midi;
+        if (next == 0 && e->type == Event::Type::Meta && e->metaType == Event::Meta::Tempo) {
+          midi.setWord((uint32_t)(e->data[0] << 16 | e->data[1] << 8 | e->data[2]) << 8);
+          f(t.tick, midi);
+          count++;
+
+        } else if (readPacket(e, &midi)) {
+          midi.setPort(next);
+          f(t.tick, midi);
+          count++;
+        }
+
+        t.end = !t.track.readEvent(t.event, t.cursor);
+        t.tick += t.event.delta;
+      }
+
+      return count;
+    }
+
+    // Reset the playback state to the start of the file.
+    void rewind() {
+      _play.nQueue = 0;
+      for (uint8_t i = 0; i < _header.nTracks; i++) {
+        _play.tracks[i]     = {};
+        _tracks[i]._running = {};
+        if (readTrackEvent(i))
+          pushTrack(i);
+      }
+
+      // The default tempo, if no tempo events are in track 0.
+      _play.tempo = {0, 0, _defaultTempoUsec};
+      _play.time  = 0;
+      _play.tick  = 0;
+      _play.entry = 0;
+
+      for (uint8_t i = 0; i < 16; i++) {
+        auto& channel   = _play.chase.channels[i];
+        channel.track   = 0;
+        channel.program = 0xff;
+        memset(channel.controllers, 0xff, sizeof(channel.controllers));
+        channel.pitchbend = _chaseUnset;
+      }
+    }
+
+    // Read the next event of a track and calculate its tick.
+    bool readTrackEvent(uint8_t i) {
+      auto& track   = _play.tracks[i];
+      track.start   = track.cursor;
+      track.running = _tracks[i]._running;
+      if (!_tracks[i].readEvent(track.event, track.cursor)) {
+        track.start = _tracks[i].length;
+        return false;
+      }
+
+      track.tick += track.event.delta;
+      return true;
+    }
+
+    bool getNextTick(uint32_t& tick) const {
+      if (_index.entries) {
+        if (_play.entry == _index.count)
+          return false;
+
+        tick = _index.entries[_play.entry].tick;
+        return true;
+      }
+
+      if (_play.nQueue == 0)
+        return false;
+
+      tick = _play.tracks[_play.queue[0]].tick;
+      return true;
+    }
+
+    bool hasEvents() const {
+      uint32_t tick;
+      return getNextTick(tick);
+    }
+
+    // Play or skip all events up to 'limit'. While playing, it returns true after
+    // a tempo change; the current tick needs to be updated before continuing.
+    bool playEvents(uint32_t limit, bool send) {
+      if (_index.entries)
+        return playIndex(limit, send);
+
+      return playTracks(limit, send);
+    }
+
+    // Play the tracks in the order of their pending events; only tracks with
+    // a due event are touched. Skipped events update the chased channel state.
+    bool playTracks(uint32_t limit, bool send) {
+      while (_play.nQueue > 0) {
+        const uint8_t i     = _play.queue[0];
+        auto&         track = _play.tracks[i];
+        if (track.tick > limit)
+          return false;
+
+        popTrack();
+
+        bool tempo{};
+        for (;;) {
+          const Event* e = &track.event;
+
+          // Track 0 might change the global playback tempo.
+          if (i == 0 && e->type == Event::Type::Meta && e->metaType == Event::Meta::Tempo) {
+            // 24 bit integer, the number of microseconds per beat. Updates the global tempo.
+            setTempoUsec(track.tick, e->data[0] << 16 | e->data[1] << 8 | e->data[2]);
+            _play.entry++;
+            tempo = true;
+
+          } else {
+            Packet midi;
+            if (readPacket(e, &midi)) {
+              _play.entry++;
+              if (send) {
+                trackNote(i, midi);
+                handleSend(i, &midi);
+
+              } else
+                chase(i, midi);
+            }
+          }
+
+          if (!readTrackEvent(i))
+            break;
+
+          // Delay event.
+          if (track.event.delta > 0) {
+            pushTrack(i);
+            break;
+          }
+        }
+
+        if (tempo && send)
+          return true;
+      }
+
+      return false;
+    }
+
+    // Play or skip the entries of the index.
+    bool playIndex(uint32_t limit, bool send) {
+      while (_play.entry < _index.count) {
+        const Entry* entry = &_index.entries[_play.entry];
+        if (entry->tick > limit)
+          return false;
+
+        _play.entry++;
+
+        Packet midi = entry->packet;
+        if (midi.getCodeIndex() == Packet::CodeIndex::Reserved) {
+          setTempoUsec(entry->tick, midi.getWord() >> 8);
+          if (send)
+            return true;
+
+          continue;
+        }
+
+        const uint8_t track = midi.getPort();
+        midi.setPort(0);
+        if (send) {
+          trackNote(track, midi);
+          handleSend(track, &midi);
+
+        } else
+          chase(track, midi);
+      }
+
+      return false;
+    }
+
+    void saveCheckpoint(Checkpoint* checkpoint, uint32_t tick) const {
+      checkpoint->tick  = tick;
+      checkpoint->entry = _play.entry;
+      checkpoint->tempo = _play.tempo;
+      checkpoint->chase = _play.chase;
+      for (uint8_t i = 0; i < _header.nTracks; i++) {
+        const auto& track             = _play.tracks[i];
+        checkpoint->tracks[i].cursor  = track.start;
+        checkpoint->tracks[i].tick    = track.tick - track.event.delta;
+        checkpoint->tracks[i].running = track.running;
+      }
+    }
+
+    // Restore the last checkpoint before or at 'tick', or rewind to the start.
+    void restoreCheckpoint(uint32_t tick) {
+      uint32_t first = 0;
+      uint32_t last  = _checkpoints.count;
+      while (first < last) {
+        const uint32_t middle = (first + last) / 2;
+        if (_checkpoints.entries[middle].tick <= tick)
+          first = middle + 1;
+
+        else
+          last = middle;
+      }
+
+      if (first == 0) {
+        rewind();
+        return;
+      }
+
+      const Checkpoint* checkpoint = &_checkpoints.entries[first - 1];
+      _play.nQueue                 = 0;
+      for (uint8_t i = 0; i < _header.nTracks; i++) {
+        auto& track         = _play.tracks[i];
+        track.cursor        = checkpoint->tracks[i].cursor;
+        track.tick          = checkpoint->tracks[i].tick;
+        _tracks[i]._running = checkpoint->tracks[i].running;
+        if (readTrackEvent(i))
+          pushTrack(i);
+      }
+
+      _play.tempo = checkpoint->tempo;
+      _play.entry = checkpoint->entry;
+      _play.chase = checkpoint->chase;
+      _play.tick  = checkpoint->tick;
+      _play.time  = getTime(checkpoint->tick);
+    }
+
+    void chase(uint8_t track, const Packet& midi) {
+      auto& channel = _play.chase.channels[midi.getChannel()];
+      switch (midi.getType()) {
+        case Packet::Status::ControlChange:
+          for (uint8_t i = 0; i < sizeof(_chaseControllers); i++) {
+            if (_chaseControllers[i] != midi.getController())
+              continue;
+
+            channel.controllers[i] = midi.getControllerValue();
+            channel.track          = track;
+          }
+          break;
+
+        case Packet::Status::ProgramChange:
+          channel.program = midi.getProgram();
+          channel.track   = track;
+          break;
+
+        case Packet::Status::PitchBend:
+          channel.pitchbend = midi.getPitchBend();
+          channel.track     = track;
+          break;
+      }
+    }
+
+    void trackNote(uint8_t track, const Packet& midi) {
+      auto&          channel = _notes.channels[midi.getChannel()];
+      const uint8_t  note    = midi.getNote();
+      const uint32_t bit     = 1UL << (note % 32);
+      const uint8_t  shift   = (note % 2) * 4;
+      switch (midi.getType()) {
+        case Packet::Status::NoteOn:
+          if (midi.getNoteVelocity() > 0) {
+            channel.notes[note / 32] |= bit;
+            channel.tracks[note / 2] = (channel.tracks[note / 2] & ~(0x0f << shift)) | track << shift;
+            break;
+          }
+
+          // A NoteOn with a velocity of 0 is a NoteOff.
+          channel.notes[note / 32] &= ~bit;
+          break;
+
+        case Packet::Status::NoteOff:
+          channel.notes[note / 32] &= ~bit;
+          break;
+      }
+    }
+
+    void releaseNotes() {
+      for (uint8_t i = 0; i < 16; i++) {
+        auto& channel = _notes.channels[i];
+        for (uint8_t note = 0; note < 128; note++) {
+          if (!(channel.notes[note / 32] & (1UL << (note % 32))))
+            continue;
+
+          const uint8_t track = (channel.tracks[note / 2] >> ((note % 2) * 4)) & 0x0f;
+          Packet        midi;
+          handleSend(track, midi.setNoteOff(i, note, 64));
+        }
+
+        memset(channel.notes, 0, sizeof(channel.notes));
+      }
+    }
+
+    void sendChase() {
+      for (uint8_t i = 0; i < 16; i++) {
+        const auto& channel = _play.chase.channels[i];
+        Packet      midi;
+
+        for (uint8_t c = 0; c < sizeof(_chaseControllers); c++) {
+          // The program change follows the bank select.
+          if (c == _chaseProgram && channel.program != 0xff)
+            handleSend(channel.track, midi.setProgram(i, channel.program));
+
+          if (channel.controllers[c] != 0xff)
+            handleSend(channel.track, midi.setControlChange(i, _chaseControllers[c], channel.controllers[c]));
+        }
+
+        if (channel.pitchbend != _chaseUnset)
+          handleSend(channel.track, midi.setPitchBend(i, channel.pitchbend));
+      }
+    }
+
+    bool isEarlier(uint8_t a, uint8_t b) const {
+      if (_play.tracks[a].tick != _play.tracks[b].tick)
+        return _play.tracks[a].tick < _play.tracks[b].tick;
+
+      return a < b;
+    }
+
+    void pushTrack(uint8_t track) {
+      uint8_t i = _play.nQueue++;
+      while (i > 0) {
+        const uint8_t parent = (i - 1) / 2;
+        if (!isEarlier(track, _play.queue[parent]))
+          break;
+
+        _play.queue[i] = _play.queue[parent];
+        i              = parent;
+      }
+
+      _play.queue[i] = track;
+    }
+
+    void popTrack() {
+      const uint8_t last = _play.queue[--_play.nQueue];
+      uint8_t       i    = 0;
+      for (;;) {
+        uint8_t child = i * 2 + 1;
+        if (child >= _play.nQueue)
+          break;
+
+        if (child + 1 < _play.nQueue && isEarlier(_play.queue[child + 1], _play.queue[child]))
+          child++;
+
+        if (!isEarlier(_play.queue[child], last))
+          break;
+
+        _play.queue[i] = _play.queue[child];
+        i              = child;
+      }
+
+      _play.queue[i] = last;
+    }
 
     // Read a 4 byte section / chunk header.
     bool readSignature(const char signature[4], uint32_t& cursor) const {
@@ -479,13 +1181,110 @@ namespace V2MIDI::File {
       return __builtin_bswap16(be16);
     }
 
-    void setTempoBPM(float bpm) {
-      const float usec = (60.f * 1000.f * 1000.f) / bpm;
-      setTempoUsec(usec);
+    // The time of a tick at the current tempo.
+    uint64_t getTime(uint32_t tick) const {
+      return _play.tempo.time + (uint64_t)(tick - _play.tempo.tick) * _play.tempo.usec;
+    }
+
+    void updateTick() {
+      _play.tick = _play.tempo.tick + (_play.time - _play.tempo.time) / _play.tempo.usec;
+    }
+
+    // Read the tempo events of track 0 and pass the segments to 'f'. Returns the
+    // number of segments; the first one is the default tempo, it is replaced by
+    // a tempo event at tick 0.
+    template <typename F> uint32_t readTempoMap(F f) const {
+      // Do not touch the Running Status of the played track.
+      Track    track  = _tracks[0];
+      uint32_t cursor = 0;
+      uint32_t tick   = 0;
+      uint32_t count  = 0;
+      Tempo    tempo{0, 0, _defaultTempoUsec};
+
+      Event e;
+      while (track.readEvent(e, cursor)) {
+        tick += e.delta;
+        if (e.type != Event::Type::Meta || e.metaType != Event::Meta::Tempo)
+          continue;
+
+        const uint32_t usec = e.data[0] << 16 | e.data[1] << 8 | e.data[2];
+        if (usec == 0)
+          continue;
+
+        // A later tempo change at the same tick replaces the pending segment.
+        if (tick > tempo.tick) {
+          f(tempo);
+          count++;
+          tempo.time += (uint64_t)(tick - tempo.tick) * tempo.usec;
+          tempo.tick = tick;
+        }
+
+        tempo.usec = usec;
+      }
+
+      f(tempo);
+      return count + 1;
+    }
+
+    // The last tempo segment which matches 'before'; a binary search in the tempo
+    // map, or a scan of track 0.
+    template <typename F> Tempo findTempo(F before) const {
+      if (!_tempoMap.entries) {
+        Tempo tempo{};
+        readTempoMap([&](const Tempo& t) {
+          if (before(t))
+            tempo = t;
+        });
+        return tempo;
+      }
+
+      uint32_t first = 1;
+      uint32_t last  = _tempoMap.count;
+      while (first < last) {
+        const uint32_t middle = (first + last) / 2;
+        if (before(_tempoMap.entries[middle]))
+          first = middle + 1;
+
+        else
+          last = middle;
+      }
+
+      return _tempoMap.entries[first - 1];
     }
 
-    void setTempoUsec(float usec) {
-      _play.tickDurationUsec = usec / (float)_header.division;
+    uint32_t readTicks() const {
+      uint32_t ticks = 0;
+      for (uint8_t i = 0; i < _header.nTracks; i++) {
+        Track    track  = _tracks[i];
+        uint32_t cursor = 0;
+        uint32_t tick   = 0;
+
+        // The delta of the EndOfTrack event pads the length of the track.
+        for (;;) {
+          Event          e;
+          const uint32_t start = cursor;
+          const bool     event = track.readEvent(e, cursor);
+          if (cursor == start)
+            break;
+
+          tick += e.delta;
+          if (!event)
+            break;
+        }
+
+        if (tick > ticks)
+          ticks = tick;
+      }
+
+      return ticks;
+    }
+
+    // Switch the tempo at 'tick', the ticks after it are counted with the new tempo.
+    void setTempoUsec(uint32_t tick, uint32_t usec) {
+      if (usec == 0)
+        return;
+
+      _play.tempo = {tick, getTime(tick), usec};
     }
   };
 }
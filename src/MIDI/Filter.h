@@ -0,0 +1,106 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "Packet.h"
+#include <array>
+
+namespace V2MIDI {
+  // Drop or remap incoming messages before they are dispatched. The settings are
+  // compiled into a table which maps every status byte to its replacement, or to 0
+  // if the message is dropped. A decision is a single lookup.
+  class Filter {
+  public:
+    constexpr Filter() {
+      reset();
+    }
+
+    // Pass all messages.
+    constexpr Filter* reset() {
+      _channels = 0xffff;
+      _types    = {};
+      for (uint8_t i = 0; i < 16; i++)
+        _map[i] = i;
+
+      _exclusive = true;
+      update();
+      return this;
+    }
+
+    // The channels which pass, bit 0 is channel 1.
+    constexpr Filter* setChannels(uint16_t channels) {
+      _channels = channels;
+      update();
+      return this;
+    }
+
+    // Drop or pass a message type; channel messages are selected by the 'Status'
+    // without a channel number.
+    constexpr Filter* setType(Packet::Status type, bool pass) {
+      if (type == Packet::Status::SystemExclusive)
+        _exclusive = pass;
+
+      else
+        _types[static_cast<uint8_t>(type) - 0x80] = !pass;
+
+      update();
+      return this;
+    }
+
+    // Deliver messages received on channel 'from' as channel 'to'.
+    constexpr Filter* mapChannel(uint8_t from, uint8_t to) {
+      _map[from & 0x0f] = to & 0x0f;
+      update();
+      return this;
+    }
+
+    // SysEx messages are passed, their payload packets need no further check.
+    constexpr bool passesSystemExclusive() const {
+      return _exclusive;
+    }
+
+    // Returns false if the packet is dropped; the status byte of remapped messages
+    // is updated.
+    constexpr bool apply(Packet* packet) const {
+      const uint32_t word = packet->getWord();
+      const uint8_t  b    = word >> 8;
+
+      // The payload of a SysEx packet.
+      if (!(b & 0x80))
+        return _exclusive;
+
+      const uint8_t status = _table[b & 0x7f];
+      if (status == 0)
+        return false;
+
+      packet->setWord((word & 0xffff00ff) | status << 8);
+      return true;
+    }
+
+  private:
+    uint16_t                _channels{};
+    std::array<bool, 128>   _types{};
+    std::array<uint8_t, 16> _map{};
+    bool                    _exclusive{};
+
+    // The replacement of the status bytes 0x80 to 0xff.
+    std::array<uint8_t, 128> _table{};
+
+    constexpr void update() {
+      for (uint16_t b = 0x80; b < 0xf0; b++) {
+        const uint8_t type    = b & 0xf0;
+        const uint8_t channel = b & 0x0f;
+        const bool    pass    = (_channels & (1 << channel)) && !_types[type - 0x80];
+        _table[b - 0x80]      = pass ? type | _map[channel] : 0;
+      }
+
+      for (uint16_t b = 0xf0; b < 0x100; b++)
+        _table[b - 0x80] = _types[b - 0x80] ? 0 : b;
+
+      // The start and the end of a SysEx message.
+      _table[static_cast<uint8_t>(Packet::Status::SystemExclusive) - 0x80]    = _exclusive ? 0xf0 : 0;
+      _table[static_cast<uint8_t>(Packet::Status::SystemExclusiveEnd) - 0x80] = _exclusive ? 0xf7 : 0;
+    }
+  };
+};
@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <cstring>
 
@@ -60,23 +61,48 @@ namespace V2MIDI {
       SystemReset                = System | 15  // n/a
     };
 
+    constexpr Packet() = default;
+
+    // The packet as a 32 bit word, the first byte of the packet is stored in the
+    // lowest 8 bits, which matches the memory layout on little-endian machines.
+    constexpr explicit Packet(uint32_t word) : _word{word} {}
+
+    constexpr uint32_t getWord() const {
+      return _word;
+    }
+
+    constexpr Packet* setWord(uint32_t word) {
+      _word = word;
+      return this;
+    }
+
+    constexpr bool operator==(const Packet& other) const {
+      return _word == other._word;
+    }
+
+    constexpr bool operator!=(const Packet& other) const {
+      return _word != other._word;
+    }
+
     // Set virtual port/wire in the packet. Port 1 == 0.
     constexpr uint8_t getPort() const {
-      return _data[0] >> 4;
+      return (_word >> 4) & 0x0f;
     }
 
     constexpr void setPort(uint8_t port) {
-      _data[0] &= 0x0f;
-      _data[0] |= port << 4;
+      _word = (_word & 0xffffff0f) | (port & 0x0f) << 4;
     }
 
-    uint8_t getChannel() const {
-      return _data[1] & 0x0f;
+    constexpr CodeIndex getCodeIndex() const {
+      return static_cast<CodeIndex>(_word & 0x0f);
+    }
+
+    constexpr uint8_t getChannel() const {
+      return (_word >> 8) & 0x0f;
     }
 
     constexpr void setChannel(uint8_t channel) {
-      _data[1] &= 0xf0;
-      _data[1] |= channel;
+      _word = (_word & 0xfffff0ff) | (channel & 0x0f) << 8;
     }
 
     constexpr static Status getStatus(uint8_t b) {
@@ -90,134 +116,101 @@ namespace V2MIDI {
     }
 
     constexpr Status getType() const {
-      return getStatus(_data[1]);
+      return getStatus(getByte(1));
+    }
+
+    // Clock, Start, Continue, Stop, ActiveSensing, Reset; they might be sent in
+    // the middle of other messages.
+    constexpr bool isRealTime() const {
+      return getByte(1) >= static_cast<uint8_t>(Status::SystemClock);
     }
 
     constexpr uint8_t getNote() const {
-      return _data[2];
+      return getByte(2);
     }
 
     constexpr uint8_t getNoteVelocity() const {
-      return _data[3];
+      return getByte(3);
     }
 
     constexpr uint8_t getAftertouchNote() const {
-      return _data[2];
+      return getByte(2);
     }
 
     constexpr uint8_t getAftertouch() const {
-      return _data[3];
+      return getByte(3);
     }
 
     constexpr uint8_t getController() const {
-      return _data[2];
+      return getByte(2);
     }
 
     constexpr uint8_t getControllerValue() const {
-      return _data[3];
+      return getByte(3);
     }
 
     constexpr uint8_t getProgram() const {
-      return _data[2];
+      return getByte(2);
     }
 
     constexpr uint8_t getAftertouchChannel() const {
-      return _data[2];
+      return getByte(2);
     }
 
     constexpr int16_t getPitchBend() const {
       // 14 bit – 8192..8191.
-      const int16_t value = _data[3] << 7 | _data[2];
+      const int16_t value = getByte(3) << 7 | getByte(2);
       return value - 8192;
     }
 
     constexpr uint16_t getSongPosition() const {
-      return _data[3] << 7 | _data[2];
+      return getByte(3) << 7 | getByte(2);
     }
 
     constexpr uint16_t getSongSelect() const {
-      return _data[2];
+      return getByte(2);
+    }
+
+    // The raw bytes, in memory order. It cannot be used in a constant expression,
+    // getByte() can.
+    const uint8_t* getData() const {
+      return reinterpret_cast<const uint8_t*>(&_word);
     }
 
-    constexpr const uint8_t* getData() const {
-      return _data;
+    constexpr uint8_t getByte(uint8_t i) const {
+      return _word >> (i * 8);
     }
 
     constexpr Packet* setData(const uint8_t data[4]) {
-      memcpy(_data, data, 4);
+      _word = data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
       return this;
     }
 
+    // The USB code index number of a message type.
+    constexpr static CodeIndex getCodeIndex(Status type) {
+      return static_cast<CodeIndex>(_encoding[static_cast<uint8_t>(type)] & 0x0f);
+    }
+
+    // The number of bytes of a message type on a serial MIDI connection, including
+    // the status byte. System Exclusive messages and invalid types return 0.
+    constexpr static uint8_t getLength(Status type) {
+      return (_encoding[static_cast<uint8_t>(type)] >> 4) & 0x03;
+    }
+
     // Encode values into the packet and return is own pointer to allow the
-    // stacking of function calls.
+    // stacking of function calls. System Exclusive messages have their own API.
     constexpr Packet* set(uint8_t channel, Status type, uint8_t data1 = 0, uint8_t data2 = 0) {
-      _data[0] &= 0xf0;
-
-      switch (type) {
-        case Status::NoteOff:
-          _data[0] |= static_cast<uint8_t>(CodeIndex::NoteOff);
-          break;
-
-        case Status::NoteOn:
-          _data[0] |= static_cast<uint8_t>(CodeIndex::NoteOn);
-          break;
-
-        case Status::Aftertouch:
-          _data[0] |= static_cast<uint8_t>(CodeIndex::Aftertouch);
-          break;
-
-        case Status::ControlChange:
-          _data[0] |= static_cast<uint8_t>(CodeIndex::ControlChange);
-          break;
-
-        case Status::ProgramChange:
-          _data[0] |= static_cast<uint8_t>(CodeIndex::ProgramChange);
-          break;
-
-        case Status::AftertouchChannel:
-          _data[0] |= static_cast<uint8_t>(CodeIndex::AftertouchChannel);
-          break;
-
-        case Status::PitchBend:
-          _data[0] |= static_cast<uint8_t>(CodeIndex::PitchBend);
-          break;
-
-        // System messages are global and encode their message type in
-        // the 'channel number'.
-        case Status::SystemSongSelect:
-        case Status::SystemTimeCodeQuarterFrame:
-          if (channel > 0)
-            return NULL;
-          _data[0] |= static_cast<uint8_t>(CodeIndex::SystemCommon2);
-          break;
-
-        case Status::SystemSongPosition:
-          if (channel > 0)
-            return NULL;
-          _data[0] |= static_cast<uint8_t>(CodeIndex::SystemCommon3);
-          break;
-
-        case Status::SystemTuneRequest:
-        case Status::SystemClock:
-        case Status::SystemStart:
-        case Status::SystemContinue:
-        case Status::SystemStop:
-        case Status::SystemActiveSensing:
-        case Status::SystemReset:
-          if (channel > 0)
-            return NULL;
-
-          _data[0] |= static_cast<uint8_t>(CodeIndex::SingleByte);
-          break;
-
-        // System Exclusive messages have their own API
-        default:
-          return NULL;
-      }
-
-      _data[1] = static_cast<uint8_t>(type) | channel;
-      _data[2] = data1;
-      _data[3] = data2;
+      const uint8_t encoding = _encoding[static_cast<uint8_t>(type)];
+      if (encoding == 0)
+        return NULL;
+
+      // System messages are global and encode their message type in
+      // the 'channel number'.
+      if ((encoding & _encodingSystem) && channel > 0)
+        return NULL;
+
+      _word = (_word & 0xf0) | (encoding & 0x0f) | (static_cast<uint8_t>(type) | channel) << 8 | data1 << 16 |
+              (uint32_t)data2 << 24;
       return this;
     }
 
@@ -256,9 +249,51 @@ namespace V2MIDI {
     }
 
   private:
-    friend class Port;
+    template <typename> friend class BasicPort;
     friend class SerialDevice;
     friend class USBDevice;
-    uint8_t _data[4]{};
+    uint32_t _word{};
+
+    // The encoding of all message types, indexed by the 'Status' value. Bits 0-3: CodeIndex,
+    // bits 4-5: the serial length, bit 7: system message. Unknown types are 0.
+    static constexpr uint8_t _encodingSystem{0x80};
+    static constexpr std::array<uint8_t, 256> _encoding = [] {
+      std::array<uint8_t, 256> table{};
+      auto add = [&table](Status type, CodeIndex codeIndex, uint8_t length) {
+        const uint8_t system = type >= Status::System ? _encodingSystem : 0;
+        table[static_cast<uint8_t>(type)] = system | length << 4 | static_cast<uint8_t>(codeIndex);
+      };
+
+      add(Status::NoteOff, CodeIndex::NoteOff, 3);
+      add(Status::NoteOn, CodeIndex::NoteOn, 3);
+      add(Status::Aftertouch, CodeIndex::Aftertouch, 3);
+      add(Status::ControlChange, CodeIndex::ControlChange, 3);
+      add(Status::ProgramChange, CodeIndex::ProgramChange, 2);
+      add(Status::AftertouchChannel, CodeIndex::AftertouchChannel, 2);
+      add(Status::PitchBend, CodeIndex::PitchBend, 3);
+      add(Status::SystemTimeCodeQuarterFrame, CodeIndex::SystemCommon2, 2);
+      add(Status::SystemSongPosition, CodeIndex::SystemCommon3, 3);
+      add(Status::SystemSongSelect, CodeIndex::SystemCommon2, 2);
+      add(Status::SystemTuneRequest, CodeIndex::SingleByte, 1);
+      add(Status::SystemClock, CodeIndex::SingleByte, 1);
+      add(Status::SystemStart, CodeIndex::SingleByte, 1);
+      add(Status::SystemContinue, CodeIndex::SingleByte, 1);
+      add(Status::SystemStop, CodeIndex::SingleByte, 1);
+      add(Status::SystemActiveSensing, CodeIndex::SingleByte, 1);
+      add(Status::SystemReset, CodeIndex::SingleByte, 1);
+      return table;
+    }();
+
+    constexpr void setByte(uint8_t i, uint8_t b) {
+      _word = (_word & ~((uint32_t)0xff << (i * 8))) | (uint32_t)b << (i * 8);
+    }
+
+    // The raw bytes for the transports.
+    uint8_t* getBytes() {
+      return reinterpret_cast<uint8_t*>(&_word);
+    }
   };
+
+  static_assert(sizeof(Packet) == 4, "Packet needs to be a 32 bit word");
+  static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "Packet layout requires a little-endian machine");
 };
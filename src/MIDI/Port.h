@@ -4,14 +4,44 @@
 #pragma once
 
 #include "Clock.h"
+#include "Filter.h"
 #include "Packet.h"
+#include "SysEx.h"
+#include "Time.h"
 #include "Transport.h"
+#include <array>
 #include <cstdlib>
+#include <type_traits>
 
 namespace V2MIDI {
+  // Storage for SysEx messages. A buffer for outgoing messages can be shared
+  // between several ports, only one port can send a message at a time.
+  struct SystemExclusiveBuffer {
+    uint8_t*    data;
+    uint32_t    size;
+    const void* sender;
+  };
+
+  // Buffer with static storage.
+  template <uint32_t storageSize> class StaticSystemExclusiveBuffer : public SystemExclusiveBuffer {
+  public:
+    constexpr StaticSystemExclusiveBuffer() : SystemExclusiveBuffer{NULL, storageSize, NULL} {
+      data = _storage.data();
+    }
+
+  private:
+    std::array<uint8_t, storageSize> _storage{};
+  };
+
   // Transport-independent MIDI functional interface. Supports message parsing/dispatching,
   // system exclusive buffering/streaming, packet statistics.
-  class Port {
+  //
+  // The handlers are resolved at compile time, the 'Derived' class provides the handlers
+  // it is interested in. Messages without a handler are discarded, their code paths
+  // and statistics are removed. The handlers need to be accessible from the base class,
+  // they are public or the derived class declares: friend class BasicPort<Derived>;
+  // A handler which is not accessible or has the wrong arguments fails to compile.
+  template <typename Derived> class BasicPort {
   public:
     struct Counter {
       uint32_t packet;
@@ -31,114 +61,358 @@ namespace V2MIDI {
       } system;
     };
 
-    Port() = delete;
-    constexpr Port(uint8_t index, uint32_t sysexSize) : _index{index}, _sysexSize{sysexSize} {}
+    BasicPort() = delete;
+    constexpr BasicPort(uint8_t index, uint32_t sysexSize) : _index{index}, _sysexSize{sysexSize} {}
 
-    void begin() {
-      // Buffer to store an incoming and outgoing SysEx messages. The buffer needs
-      // to be able to carry a complete message. The message always starts with
-      // 0xf0 (SystemExclusive) and ends with 0xf7 (SystemExclusiveEnd), all other
-      // bytes carry 7-bit only.
-      //
-      // If no buffer is provided, incoming SysEx messages are discarded.
-      _sysex.in.buffer  = (uint8_t*)malloc(_sysexSize);
-      _sysex.out.buffer = (uint8_t*)malloc(_sysexSize);
+    // A port which is not static, like one created with 'new', releases the
+    // buffers allocated by begin().
+    ~BasicPort() {
+      end();
     }
 
-    // During dispatch(), replies can be sent back to the given 'transport'.
-    void dispatch(Transport* transport, Packet* packet) {
-      _statistics.input.packet++;
-
-      if (!storeSystemExclusive(packet))
+    // Allocate the SysEx buffers from the heap.
+    void begin() {
+      if (_sysexSize == 0 || _sysex.allocated)
         return;
 
-      if (packet->getType() != Packet::Status::SystemExclusive)
-        handlePacket(packet);
-
-      switch (packet->getType()) {
-        case Packet::Status::NoteOn:
-          _statistics.input.note++;
-          handleNote(packet->getChannel(), packet->getNote(), packet->getNoteVelocity());
-          break;
-
-        case Packet::Status::NoteOff:
-          _statistics.input.noteOff++;
-          handleNoteOff(packet->getChannel(), packet->getNote(), packet->getNoteVelocity());
-          break;
-
-        case Packet::Status::Aftertouch:
-          _statistics.input.aftertouch++;
-          handleAftertouch(packet->getChannel(), packet->getAftertouchNote(), packet->getAftertouch());
-          break;
+      _sysex.allocated        = true;
+      _sysex.in.buffer        = (uint8_t*)malloc(_sysexSize);
+      _sysex.in.size          = _sysex.in.buffer ? _sysexSize : 0;
+      _sysex.out.owned.data   = (uint8_t*)malloc(_sysexSize);
+      _sysex.out.owned.size   = _sysex.out.owned.data ? _sysexSize : 0;
+      _sysex.out.owned.sender = NULL;
+      _sysex.out.buffer       = &_sysex.out.owned;
+    }
 
-        case Packet::Status::ControlChange:
-          _statistics.input.control++;
-          handleControlChange(packet->getChannel(), packet->getController(), packet->getControllerValue());
-          break;
+    // Buffer to store an incoming and outgoing SysEx messages. The buffer needs
+    // to be able to carry a complete message. The message always starts with
+    // 0xf0 (SystemExclusive) and ends with 0xf7 (SystemExclusiveEnd), all other
+    // bytes carry 7-bit only.
+    //
+    // If no buffer is provided, incoming SysEx messages are discarded, outgoing
+    // messages cannot be sent.
+    void begin(SystemExclusiveBuffer* in, SystemExclusiveBuffer* out) {
+      end();
+      _sysex.in.buffer  = in ? in->data : NULL;
+      _sysex.in.size    = in ? in->size : 0;
+      _sysex.out.buffer = out;
+    }
 
-        case Packet::Status::ProgramChange:
-          _statistics.input.program++;
-          handleProgramChange(packet->getChannel(), packet->getProgram());
-          break;
+    // Release the buffers allocated by begin().
+    void end() {
+      resetSystemExclusive();
 
-        case Packet::Status::AftertouchChannel:
-          _statistics.input.aftertouchChannel++;
-          handleAftertouchChannel(packet->getChannel(), packet->getAftertouchChannel());
-          break;
+      if (_sysex.allocated) {
+        free(_sysex.in.buffer);
+        free(_sysex.out.owned.data);
+        _sysex.out.owned = {};
+        _sysex.allocated = false;
+      }
 
-        case Packet::Status::PitchBend:
-          _statistics.input.pitchbend++;
-          handlePitchBend(packet->getChannel(), packet->getPitchBend());
-          break;
+      _sysex.in.buffer  = NULL;
+      _sysex.in.size    = 0;
+      _sysex.out.buffer = NULL;
+    }
 
-        case Packet::Status::SystemSongPosition:
-          handleSongPosition(packet->getSongPosition());
-          break;
+    // Stream incoming SysEx messages through a ring buffer instead of collecting
+    // the complete message. Every time one half of the buffer is filled, the chunk
+    // is passed to handleSystemExclusiveChunk(); it stays valid until the other half
+    // is filled. The 'offset' is the position of the chunk in the message, the
+    // message starts with 0xf0. The last chunk ending with 0xf7 is marked 'final'.
+    // An aborted message has no 'final' chunk, a new message starts at offset 0.
+    // A NULL buffer or a 'size' smaller than 2 disables the streaming.
+    void setSystemExclusiveStream(uint8_t* buffer, uint32_t size) {
+      _sysex.in.stream.buffer = size < 2 ? NULL : buffer;
+      _sysex.in.stream.chunk  = size / 2;
+      _sysex.in.reset();
+    }
 
-        case Packet::Status::SystemSongSelect:
-          handleSongSelect(packet->getSongSelect());
-          break;
+    // Drop or remap incoming packets before they are dispatched. Dropped packets
+    // are not counted.
+    void setFilter(const Filter* filter) {
+      _filter = filter;
+    }
 
-        case Packet::Status::SystemClock:
-          _statistics.input.system.clock.tick++;
-          handleClock(Clock::Event::Tick);
-          break;
+    // During dispatch(), replies can be sent back to the given 'transport'.
+    void dispatch(Transport* transport, Packet* packet) {
+      if (_filter && !_filter->apply(packet))
+        return;
 
-        case Packet::Status::SystemStart:
-          handleClock(Clock::Event::Start);
-          break;
+      _statistics.input.packet++;
 
-        case Packet::Status::SystemContinue:
-          handleClock(Clock::Event::Continue);
-          break;
+      // Select the statistics counter and the handler with the packet's code index.
+      const Dispatch& entry = _dispatch[static_cast<uint8_t>(packet->getCodeIndex())];
+      if (entry.counter)
+        (_statistics.input.*entry.counter)++;
 
-        case Packet::Status::SystemStop:
-          handleClock(Clock::Event::Stop);
-          break;
+      entry.handle(this, transport, packet);
+    }
 
-        case Packet::Status::SystemExclusive: {
-          _statistics.input.system.exclusive++;
-          handleSystemExclusive(transport, _sysex.in.buffer, _sysex.in.length);
-          handleSystemExclusive(_sysex.in.buffer, _sysex.in.length);
-        } break;
+    // Dispatch an array of packets, like a complete USB endpoint buffer. The payload
+    // of a running SysEx stream is copied in one go, all other packets are passed
+    // to dispatch(). A filter which drops SysEx messages sees every packet.
+    void dispatch(Transport* transport, Packet* packets, size_t count) {
+      const bool bulk = !_filter || _filter->passesSystemExclusive();
+
+      for (size_t i = 0; i < count;) {
+        if (bulk && _sysex.in.appending && !_sysex.in.stream.buffer) {
+          const uint32_t n = SysEx::depacketize(packets + i,
+                                                count - i,
+                                                _sysex.in.buffer + _sysex.in.length,
+                                                _sysex.in.size - _sysex.in.length);
+          if (n > 0) {
+            _statistics.input.packet += n;
+            _sysex.in.length += n * 3;
+            i += n;
+            continue;
+          }
+        }
 
-        case Packet::Status::SystemReset:
-          _statistics.input.system.reset++;
-          handleSystemReset();
-          break;
+        dispatch(transport, packets + i);
+        i++;
       }
     }
 
     // Set the port's number in the outgoing packet and updates the statistics.
     bool send(Packet* packet) {
+      // Real-time messages bypass an ongoing system exclusive transfer.
+      if (packet->isRealTime())
+        return sendRealTime(packet);
+
       // Do not interrupt a system exclusive transfer.
       if (_sysex.out.length > 0)
         return false;
 
       packet->setPort(_index);
-      if (!handleSend(packet))
+      if (!derived()->handleSend(packet))
         return false;
 
+      countOutput(packet);
+      return true;
+    }
+
+    // Get the raw buffer to copy the SysEx message into. A shared buffer is not
+    // available while another port is sending a message.
+    uint8_t* getSystemExclusiveBuffer() {
+      if (!isSystemExclusiveBufferAvailable())
+        return NULL;
+
+      return _sysex.out.buffer->data;
+    }
+
+    uint32_t getSystemExclusiveBufferSize() const {
+      if (!_sysex.out.buffer)
+        return 0;
+
+      return _sysex.out.buffer->size;
+    }
+
+    // Prepare SysEx message to chunk into packets. Send as many packets as possible,
+    // the remaining packets will be sent with loopSystemExclusive().
+    void sendSystemExclusive(Transport* transport, uint32_t length) {
+      if (!queueSystemExclusive(transport, length))
+        return;
+
+      // Send as many packets as possible.
+      if (transport) {
+        sendSystemExclusivePackets();
+        return;
+      }
+
+      while (loopSystemExclusive() > 0)
+        ;
+    }
+
+    // Prepare SysEx message to chunk into packets without sending anything. All
+    // packets will be sent with loopSystemExclusive().
+    bool queueSystemExclusive(Transport* transport, uint32_t length) {
+      if (length < 2)
+        return false;
+
+      if (!isSystemExclusiveBufferAvailable())
+        return false;
+
+      if (length > _sysex.out.buffer->size)
+        return false;
+
+      if (_sysex.out.buffer->data[0] != static_cast<uint8_t>(Packet::Status::SystemExclusive))
+        return false;
+
+      if (_sysex.out.buffer->data[length - 1] != static_cast<uint8_t>(Packet::Status::SystemExclusiveEnd))
+        return false;
+
+      _sysex.out.buffer->sender = this;
+      _sysex.out.transport      = transport;
+      _sysex.out.length         = length;
+      _sysex.out.position       = 0;
+      return true;
+    }
+
+    bool isSendingSystemExclusive() const {
+      return _sysex.out.length > 0;
+    }
+
+    void resetSystemExclusive() {
+      _sysex.in.reset();
+
+      if (_sysex.out.length > 0)
+        _sysex.out.buffer->sender = NULL;
+      _sysex.out.reset();
+
+      // Nothing will flush the queued real-time messages.
+      _statistics.realtime.dropped += _realtime.count;
+      _realtime.count = 0;
+    }
+
+    // Send the next packet over the specified transport. Returns:
+    //  0: nothing to do,
+    // -1: sending failed,
+    //  1: there are remaining packets.
+    int8_t loopSystemExclusive() {
+      if (_sysex.out.length == 0)
+        return 0;
+
+      // Queued real-time messages go ahead of the SysEx packets.
+      if (!flushRealTime())
+        return -1;
+
+      Packet _packet;
+      SysEx::packetize(_sysex.out.buffer->data, _sysex.out.length, _sysex.out.position, _index, &_packet, 1);
+      if (!sendPacket(_sysex.out.transport, &_packet))
+        return -1;
+
+      _statistics.output.packet++;
+      _sysex.out.position += 3;
+      if (_sysex.out.position < _sysex.out.length)
+        return 1;
+
+      finishSystemExclusive();
+      return 0;
+    }
+
+  protected:
+    const uint8_t  _index;
+    const uint32_t _sysexSize;
+
+    friend class Scheduler;
+
+    // The priority lane for real-time messages.
+    struct RealTimeCounter {
+      uint32_t packet;
+      uint32_t interleaved;
+      uint32_t queued;
+      uint32_t dropped;
+      uint32_t latencyUsec;
+      uint32_t latencyMaxUsec;
+    };
+
+    struct {
+      Counter         input;
+      Counter         output;
+      RealTimeCounter realtime;
+    } _statistics{};
+
+    // The default handlers, they are not called.
+    struct Unhandled {};
+    Unhandled handleNote(uint8_t channel, uint8_t note, uint8_t velocity) {
+      return {};
+    }
+    Unhandled handleNoteOff(uint8_t channel, uint8_t note, uint8_t velocity) {
+      return {};
+    }
+    Unhandled handleAftertouch(uint8_t channel, uint8_t note, uint8_t pressure) {
+      return {};
+    }
+    Unhandled handleControlChange(uint8_t channel, uint8_t controller, uint8_t value) {
+      return {};
+    }
+    Unhandled handleProgramChange(uint8_t channel, uint8_t value) {
+      return {};
+    }
+    Unhandled handleAftertouchChannel(uint8_t channel, uint8_t pressure) {
+      return {};
+    }
+    Unhandled handlePitchBend(uint8_t channel, int16_t value) {
+      return {};
+    }
+    Unhandled handleSongPosition(uint16_t beats) {
+      return {};
+    }
+    Unhandled handleSongSelect(uint8_t number) {
+      return {};
+    }
+    Unhandled handleClock(Clock::Event clock) {
+      return {};
+    }
+    Unhandled handleSystemExclusive(const uint8_t* buffer, uint32_t len) {
+      return {};
+    }
+    Unhandled handleSystemReset() {
+      return {};
+    }
+    Unhandled handlePacket(Packet* packet) {
+      return {};
+    }
+    Unhandled handleSystemExclusive(Transport* transport, const uint8_t* buffer, uint32_t len) {
+      return {};
+    }
+    Unhandled handleSystemExclusiveChunk(uint32_t offset, const uint8_t* data, uint32_t len, bool final) {
+      return {};
+    }
+
+    bool handleSend(Packet* packet) {
+      return false;
+    }
+
+  private:
+    Derived* derived() {
+      return static_cast<Derived*>(this);
+    }
+
+    // Send over the transport, or pass the packet to the derived class.
+    bool sendPacket(Transport* transport, Packet* packet) {
+      if (!transport)
+        return derived()->handleSend(packet);
+
+      return transport->send(packet);
+    }
+
+    // Convert the remaining message into packets and pass them in batches to the transport.
+    void sendSystemExclusivePackets() {
+      Packet packets[16];
+
+      while (_sysex.out.length > 0) {
+        if (!flushRealTime())
+          return;
+
+        const uint32_t n    = SysEx::packetize(_sysex.out.buffer->data,
+                                               _sysex.out.length,
+                                               _sysex.out.position,
+                                               _index,
+                                               packets,
+                                               sizeof(packets) / sizeof(packets[0]));
+        const size_t   sent = _sysex.out.transport->send(packets, n);
+        _statistics.output.packet += sent;
+        _sysex.out.position += sent * 3;
+
+        if (_sysex.out.position >= _sysex.out.length) {
+          finishSystemExclusive();
+          return;
+        }
+
+        if (sent < n)
+          return;
+      }
+    }
+
+    void finishSystemExclusive() {
+      _sysex.out.buffer->sender = NULL;
+      _sysex.out.transport      = NULL;
+      _sysex.out.length         = 0;
+      _statistics.output.system.exclusive++;
+    }
+
+    void countOutput(const Packet* packet) {
       _statistics.output.packet++;
 
       switch (packet->getType()) {
@@ -178,155 +452,187 @@ namespace V2MIDI {
           _statistics.output.system.reset++;
           break;
       }
-
-      return true;
     }
 
-    // Get the raw buffer to copy the SysEx message into.
-    uint8_t* getSystemExclusiveBuffer() {
-      return _sysex.out.buffer;
+    // Real-time messages can be sent in the middle of a SysEx transfer. If the
+    // transport is busy during a transfer, they are queued and sent ahead of the
+    // next SysEx packet. Other messages are refused.
+    bool sendRealTime(Packet* packet) {
+      return sendRealTime(NULL, packet);
     }
 
-    // Prepare SysEx message to chunk into packets. Send as many packets as possible,
-    // the remaining packets will be sent with loopSystemExclusive().
-    void sendSystemExclusive(Transport* transport, uint32_t length) {
-      if (length < 2)
-        return;
+    // Send the real-time message over the given transport instead of handleSend().
+    bool sendRealTime(Transport* transport, Packet* packet) {
+      if (!packet->isRealTime())
+        return false;
 
-      if (_sysex.out.buffer[0] != static_cast<uint8_t>(Packet::Status::SystemExclusive))
-        return;
+      packet->setPort(_index);
 
-      if (_sysex.out.buffer[length - 1] != static_cast<uint8_t>(Packet::Status::SystemExclusiveEnd))
-        return;
+      if (_realtime.count == 0 && sendPacket(transport, packet)) {
+        _statistics.realtime.packet++;
+        if (_sysex.out.length > 0)
+          _statistics.realtime.interleaved++;
 
-      _sysex.out.transport = transport;
-      _sysex.out.length    = length;
-      _sysex.out.position  = 0;
+        countOutput(packet);
+        return true;
+      }
 
-      // Send as many packets as possible.
-      while (loopSystemExclusive() > 0)
-        ;
-    }
+      // Nothing will flush the queue. A port with a given transport is added to a
+      // Scheduler, its loop() flushes the queue.
+      if (!transport && _sysex.out.length == 0 && _realtime.count == 0)
+        return false;
 
-    void resetSystemExclusive() {
-      _sysex.in.reset();
-      _sysex.out.reset();
-    }
+      if (_realtime.count == _maxRealTime) {
+        _statistics.realtime.dropped++;
+        return false;
+      }
 
-    // Send the next packet over the specified transport. Returns:
-    //  0: nothing to do,
-    // -1: sending failed,
-    //  1: there are remaining packets.
-    int8_t loopSystemExclusive() {
-      if (_sysex.out.length == 0)
-        return 0;
+      auto& entry     = _realtime.queue[(_realtime.first + _realtime.count) % _maxRealTime];
+      entry.packet    = *packet;
+      entry.transport = transport;
+      entry.usec      = Time::getUsec();
+      _realtime.count++;
+      _statistics.realtime.queued++;
+      return true;
+    }
 
-      Packet         _packet;
-      const uint32_t remain = _sysex.out.length - _sysex.out.position;
-      switch (remain) {
-        case 1:
-          _packet._data[0] = (_index << 4) | static_cast<uint8_t>(Packet::CodeIndex::SystemExclusiveEnd1);
-          _packet._data[1] = _sysex.out.buffer[_sysex.out.position];
-          _packet._data[2] = 0;
-          _packet._data[3] = 0;
-          break;
+    bool flushRealTime() {
+      while (_realtime.count > 0) {
+        auto& entry = _realtime.queue[_realtime.first];
+        if (!sendPacket(entry.transport, &entry.packet))
+          return false;
 
-        case 2:
-          _packet._data[0] = (_index << 4) | static_cast<uint8_t>(Packet::CodeIndex::SystemExclusiveEnd2);
-          _packet._data[1] = _sysex.out.buffer[_sysex.out.position];
-          _packet._data[2] = _sysex.out.buffer[_sysex.out.position + 1];
-          _packet._data[3] = 0;
-          break;
+        const uint32_t usec = Time::getUsecSince(entry.usec);
+        _statistics.realtime.latencyUsec = usec;
+        if (usec > _statistics.realtime.latencyMaxUsec)
+          _statistics.realtime.latencyMaxUsec = usec;
 
-        case 3:
-          _packet._data[0] = (_index << 4) | static_cast<uint8_t>(Packet::CodeIndex::SystemExclusiveEnd3);
-          _packet._data[1] = _sysex.out.buffer[_sysex.out.position];
-          _packet._data[2] = _sysex.out.buffer[_sysex.out.position + 1];
-          _packet._data[3] = _sysex.out.buffer[_sysex.out.position + 2];
-          break;
+        _statistics.realtime.packet++;
+        if (_sysex.out.length > 0)
+          _statistics.realtime.interleaved++;
 
-        default:
-          _packet._data[0] = (_index << 4) | static_cast<uint8_t>(Packet::CodeIndex::SystemExclusiveStart);
-          _packet._data[1] = _sysex.out.buffer[_sysex.out.position];
-          _packet._data[2] = _sysex.out.buffer[_sysex.out.position + 1];
-          _packet._data[3] = _sysex.out.buffer[_sysex.out.position + 2];
-          break;
+        countOutput(&entry.packet);
+        _realtime.first = (_realtime.first + 1) % _maxRealTime;
+        _realtime.count--;
       }
 
-      if (!_sysex.out.transport) {
-        if (!handleSend(&_packet))
-          return -1;
+      return true;
+    }
 
-      } else {
-        if (!_sysex.out.transport->send(&_packet))
-          return -1;
-      }
+    bool isSystemExclusiveBufferAvailable() const {
+      if (!_sysex.out.buffer)
+        return false;
 
-      _statistics.output.packet++;
+      return !_sysex.out.buffer->sender || _sysex.out.buffer->sender == this;
+    }
 
-      if (remain > 3) {
-        _sysex.out.position += 3;
-        return 1;
-      }
+    // Check if the derived class provides a handler. The call is not evaluated,
+    // a default handler returns 'Unhandled'. A handler which cannot be called is
+    // declared by the derived class with the wrong arguments or is not accessible,
+    // its messages would be silently dropped.
+    template <typename Call> static constexpr bool isHandled(Call call) {
+      static_assert(std::is_invocable_v<Call, Derived*>,
+                    "Handler not accessible or wrong arguments, see: friend class BasicPort<Derived>");
+      return !std::is_same_v<std::invoke_result_t<Call, Derived*>, Unhandled>;
+    }
 
-      _sysex.out.transport = NULL;
-      _sysex.out.length    = 0;
-      _statistics.output.system.exclusive++;
-      return 0;
+    // The overloads of handleSystemExclusive() hide each other, the derived class
+    // provides only one of them.
+    template <typename Call> static constexpr bool isHandledOverload(Call call) {
+      if constexpr (std::is_invocable_v<Call, Derived*>)
+        return !std::is_same_v<std::invoke_result_t<Call, Derived*>, Unhandled>;
+      else
+        return false;
     }
 
-  protected:
-    const uint8_t  _index;
-    const uint32_t _sysexSize;
+    struct Handles {
+      static constexpr bool note = isHandled([](auto* d) -> decltype(d->handleNote(0, 0, 0)) {
+        return d->handleNote(0, 0, 0);
+      });
+      static constexpr bool noteOff = isHandled([](auto* d) -> decltype(d->handleNoteOff(0, 0, 0)) {
+        return d->handleNoteOff(0, 0, 0);
+      });
+      static constexpr bool aftertouch = isHandled([](auto* d) -> decltype(d->handleAftertouch(0, 0, 0)) {
+        return d->handleAftertouch(0, 0, 0);
+      });
+      static constexpr bool control = isHandled([](auto* d) -> decltype(d->handleControlChange(0, 0, 0)) {
+        return d->handleControlChange(0, 0, 0);
+      });
+      static constexpr bool program = isHandled([](auto* d) -> decltype(d->handleProgramChange(0, 0)) {
+        return d->handleProgramChange(0, 0);
+      });
+      static constexpr bool aftertouchChannel =
+        isHandled([](auto* d) -> decltype(d->handleAftertouchChannel(0, 0)) {
+          return d->handleAftertouchChannel(0, 0);
+        });
+      static constexpr bool pitchbend = isHandled([](auto* d) -> decltype(d->handlePitchBend(0, 0)) {
+        return d->handlePitchBend(0, 0);
+      });
+      static constexpr bool songPosition = isHandled([](auto* d) -> decltype(d->handleSongPosition(0)) {
+        return d->handleSongPosition(0);
+      });
+      static constexpr bool songSelect = isHandled([](auto* d) -> decltype(d->handleSongSelect(0)) {
+        return d->handleSongSelect(0);
+      });
+      static constexpr bool clock = isHandled([](auto* d) -> decltype(d->handleClock(Clock::Event::Tick)) {
+        return d->handleClock(Clock::Event::Tick);
+      });
+      static constexpr bool reset = isHandled([](auto* d) -> decltype(d->handleSystemReset()) {
+        return d->handleSystemReset();
+      });
+      static constexpr bool packet = isHandled([](auto* d) -> decltype(d->handlePacket(NULL)) {
+        return d->handlePacket(NULL);
+      });
+      static constexpr auto callExclusive = [](auto* d) -> decltype(d->handleSystemExclusive(NULL, 0)) {
+        return d->handleSystemExclusive(NULL, 0);
+      };
+      static constexpr auto callExclusiveTransport =
+        [](auto* d) -> decltype(d->handleSystemExclusive(NULL, NULL, 0)) {
+          return d->handleSystemExclusive(NULL, NULL, 0);
+        };
+      static_assert(std::is_invocable_v<decltype(callExclusive), Derived*> ||
+                      std::is_invocable_v<decltype(callExclusiveTransport), Derived*>,
+                    "Handler not accessible or wrong arguments, see: friend class BasicPort<Derived>");
+      static constexpr bool exclusive          = isHandledOverload(callExclusive);
+      static constexpr bool exclusiveTransport = isHandledOverload(callExclusiveTransport);
+      static constexpr bool exclusiveChunk =
+        isHandled([](auto* d) -> decltype(d->handleSystemExclusiveChunk(0, NULL, 0, false)) {
+          return d->handleSystemExclusiveChunk(0, NULL, 0, false);
+        });
+    };
 
-    friend class Packet;
     struct {
-      Counter input;
-      Counter output;
-    } _statistics{};
+      // The buffers are allocated by begin().
+      bool allocated;
 
-    virtual void handleNote(uint8_t channel, uint8_t note, uint8_t velocity) {}
-    virtual void handleNoteOff(uint8_t channel, uint8_t note, uint8_t velocity) {}
-    virtual void handleAftertouch(uint8_t channel, uint8_t note, uint8_t pressure) {}
-    virtual void handleControlChange(uint8_t channel, uint8_t controller, uint8_t value) {}
-    virtual void handleProgramChange(uint8_t channel, uint8_t value) {}
-    virtual void handleAftertouchChannel(uint8_t channel, uint8_t pressure) {}
-    virtual void handlePitchBend(uint8_t channel, int16_t value) {}
-    virtual void handleSongPosition(uint16_t beats){};
-    virtual void handleSongSelect(uint8_t number){};
-    virtual void handleClock(Clock::Event clock) {}
-    virtual void handleSystemExclusive(const uint8_t* buffer, uint32_t len) {}
-    virtual void handleSystemReset() {}
-    virtual void handleSwitchChannel(uint8_t channel) {}
-
-    // All messages besides system exclusive.
-    virtual void handlePacket(Packet* packet) {}
-
-    // During dispatch, replies are sent back to the originating transport.
-    virtual void handleSystemExclusive(Transport* transport, const uint8_t* buffer, uint32_t len) {}
-
-    virtual bool handleSend(Packet* packet) {
-      return false;
-    }
-
-  private:
-    struct {
       struct {
         uint8_t* buffer;
+        uint32_t size;
         uint32_t length;
         bool     appending;
 
+        // The caller-provided ring buffer, split into two chunks.
+        struct {
+          uint8_t* buffer;
+          uint32_t chunk;
+          uint32_t fill;
+          bool     second;
+        } stream;
+
         void reset() {
-          length    = 0;
-          appending = false;
+          length        = 0;
+          appending     = false;
+          stream.fill   = 0;
+          stream.second = false;
         }
       } in;
 
       struct {
-        Transport* transport;
-        uint8_t*   buffer;
-        uint32_t   length;
-        uint32_t   position;
+        SystemExclusiveBuffer* buffer;
+        SystemExclusiveBuffer  owned;
+        Transport*             transport;
+        uint32_t               length;
+        uint32_t               position;
 
         void reset() {
           length   = 0;
@@ -335,135 +641,157 @@ namespace V2MIDI {
       } out;
     } _sysex{};
 
+    static constexpr uint8_t _maxRealTime{4};
+    struct {
+      struct {
+        Packet     packet;
+        Transport* transport;
+        uint32_t   usec;
+      } queue[_maxRealTime];
+      uint8_t first;
+      uint8_t count;
+    } _realtime{};
+
+    const Filter* _filter{};
+
+    // Append bytes to the buffer, or pass them along in chunks of the stream.
+    bool appendSystemExclusive(const uint8_t* bytes, uint8_t n) {
+      if (_sysex.in.stream.buffer) {
+        for (uint8_t i = 0; i < n; i++) {
+          uint8_t* chunk = _sysex.in.stream.buffer + (_sysex.in.stream.second ? _sysex.in.stream.chunk : 0);
+          chunk[_sysex.in.stream.fill++] = bytes[i];
+          _sysex.in.length++;
+
+          if (_sysex.in.stream.fill == _sysex.in.stream.chunk)
+            flushSystemExclusiveStream(false);
+        }
+
+        return true;
+      }
+
+      // Not enough space to store the message.
+      if (_sysex.in.length + n > _sysex.in.size) {
+        _sysex.in.reset();
+        return false;
+      }
+
+      memcpy(_sysex.in.buffer + _sysex.in.length, bytes, n);
+      _sysex.in.length += n;
+      return true;
+    }
+
+    void flushSystemExclusiveStream(bool final) {
+      const uint8_t* chunk = _sysex.in.stream.buffer + (_sysex.in.stream.second ? _sysex.in.stream.chunk : 0);
+      if constexpr (Handles::exclusiveChunk)
+        derived()->handleSystemExclusiveChunk(_sysex.in.length - _sysex.in.stream.fill,
+                                              chunk,
+                                              _sysex.in.stream.fill,
+                                              final);
+
+      _sysex.in.stream.second = !_sysex.in.stream.second;
+      _sysex.in.stream.fill   = 0;
+    }
+
     bool storeSystemExclusive(Packet* packet) {
-      switch (static_cast<Packet::CodeIndex>(packet->_data[0] & 0x0f)) {
-        case Packet::CodeIndex::SystemCommon2:
-        case Packet::CodeIndex::SystemCommon3:
-        case Packet::CodeIndex::NoteOff:
-        case Packet::CodeIndex::NoteOn:
-        case Packet::CodeIndex::Aftertouch:
-        case Packet::CodeIndex::ControlChange:
-        case Packet::CodeIndex::ProgramChange:
-        case Packet::CodeIndex::AftertouchChannel:
-        case Packet::CodeIndex::PitchBend:
-          // Return single packet message, discard any possible SysEx stream.
-          _sysex.in.appending = false;
-          _sysex.in.length    = 0;
-          return true;
+      // A new message while the current one is incomplete; the sender has aborted it,
+      // like a serial MIDI connection does by sending a new status byte.
+      if (_sysex.in.appending && packet->getByte(1) == static_cast<uint8_t>(Packet::Status::SystemExclusive))
+        _sysex.in.reset();
 
+      switch (packet->getCodeIndex()) {
         case Packet::CodeIndex::SingleByte:
+          // Real-time messages might be sent in the middle of a SysEx stream.
+          if (packet->isRealTime())
+            return true;
+
           // Single byte, like a system message.
           if (!_sysex.in.appending) {
             _sysex.in.reset();
             return true;
           }
 
-          // Used in the middle of a SysEx packet stream to transport a single byte instead of three.
-          if (_sysex.in.length + 1 > _sysexSize) {
+          // A status byte aborts the message, like a Tune Request on a serial
+          // MIDI connection.
+          if (packet->getByte(1) & 0x80) {
             _sysex.in.reset();
-            return false;
+            return true;
           }
 
-          _sysex.in.buffer[_sysex.in.length++] = packet->_data[1];
+          // Used in the middle of a SysEx packet stream to transport a single byte instead of three.
+          appendSystemExclusive(packet->getData() + 1, 1);
           return false;
 
         // Start of a new SysEx stream, or append data to the current stream.
         case Packet::CodeIndex::SystemExclusiveStart:
-          // Not enough space to store the stream.
-          if (_sysex.in.length + 3 > _sysexSize) {
-            _sysex.in.reset();
-            return false;
-          }
-
           if (!_sysex.in.appending) {
-            _sysex.in.length = 0;
+            _sysex.in.reset();
 
             // Must be the start of a SysEx.
-            if (packet->_data[1] != static_cast<uint8_t>(Packet::Status::SystemExclusive))
+            if (packet->getByte(1) != static_cast<uint8_t>(Packet::Status::SystemExclusive))
               return false;
 
             _sysex.in.appending = true;
           }
 
-          _sysex.in.buffer[_sysex.in.length++] = packet->_data[1];
-          _sysex.in.buffer[_sysex.in.length++] = packet->_data[2];
-          _sysex.in.buffer[_sysex.in.length++] = packet->_data[3];
+          appendSystemExclusive(packet->getData() + 1, 3);
           return false;
 
         // End of SysEx stream with various lengths.
         case Packet::CodeIndex::SystemExclusiveEnd1:
           // Invalid 'End' packet
-          if (packet->_data[1] != static_cast<uint8_t>(Packet::Status::SystemExclusiveEnd)) {
+          if (packet->getByte(1) != static_cast<uint8_t>(Packet::Status::SystemExclusiveEnd)) {
             _sysex.in.reset();
             return false;
           }
 
           // 'End' packet without previous data, discarding.
           if (!_sysex.in.appending) {
-            _sysex.in.length = 0;
-            return false;
-          }
-
-          // Not enough space to store the stream.
-          if (_sysex.in.length + 1 > _sysexSize) {
             _sysex.in.reset();
             return false;
           }
 
-          _sysex.in.buffer[_sysex.in.length++] = packet->_data[1];
+          if (!appendSystemExclusive(packet->getData() + 1, 1))
+            return false;
           break;
 
         case Packet::CodeIndex::SystemExclusiveEnd2:
           // Invalid 'End' packet.
-          if (packet->_data[2] != static_cast<uint8_t>(Packet::Status::SystemExclusiveEnd)) {
-            _sysex.in.reset();
-            return false;
-          }
-
-          // Not enough space to store the stream.
-          if (_sysex.in.length + 2 > _sysexSize) {
+          if (packet->getByte(2) != static_cast<uint8_t>(Packet::Status::SystemExclusiveEnd)) {
             _sysex.in.reset();
             return false;
           }
 
           // Single 'End' packet.
           if (!_sysex.in.appending) {
-            _sysex.in.length = 0;
+            _sysex.in.reset();
 
             // Must be an 'empty' SysEx.
-            if (packet->_data[1] != static_cast<uint8_t>(Packet::Status::SystemExclusive))
+            if (packet->getByte(1) != static_cast<uint8_t>(Packet::Status::SystemExclusive))
               return false;
           }
 
-          _sysex.in.buffer[_sysex.in.length++] = packet->_data[1];
-          _sysex.in.buffer[_sysex.in.length++] = packet->_data[2];
+          if (!appendSystemExclusive(packet->getData() + 1, 2))
+            return false;
           break;
 
         case Packet::CodeIndex::SystemExclusiveEnd3:
           // Invalid 'End' packet.
-          if (packet->_data[3] != static_cast<uint8_t>(Packet::Status::SystemExclusiveEnd)) {
-            _sysex.in.reset();
-            return false;
-          }
-
-          // Not enough space to store the stream.
-          if (_sysex.in.length + 3 > _sysexSize) {
+          if (packet->getByte(3) != static_cast<uint8_t>(Packet::Status::SystemExclusiveEnd)) {
             _sysex.in.reset();
             return false;
           }
 
           // Single 'End' packet.
           if (!_sysex.in.appending) {
-            _sysex.in.length = 0;
+            _sysex.in.reset();
 
             // Must be a 'one byte' SysEx.
-            if (packet->_data[1] != static_cast<uint8_t>(Packet::Status::SystemExclusive))
+            if (packet->getByte(1) != static_cast<uint8_t>(Packet::Status::SystemExclusive))
               return false;
           }
 
-          _sysex.in.buffer[_sysex.in.length++] = packet->_data[1];
-          _sysex.in.buffer[_sysex.in.length++] = packet->_data[2];
-          _sysex.in.buffer[_sysex.in.length++] = packet->_data[3];
+          if (!appendSystemExclusive(packet->getData() + 1, 3))
+            return false;
           break;
 
         default:
@@ -473,8 +801,237 @@ namespace V2MIDI {
 
       // Always return 'SystemExclusive' as type.
       _sysex.in.appending = false;
-      packet->_data[1]    = static_cast<uint8_t>(Packet::Status::SystemExclusive);
+      packet->setByte(1, static_cast<uint8_t>(Packet::Status::SystemExclusive));
       return true;
     }
+
+    // The handlers of the dispatch table. Single packet messages discard any
+    // possible incomplete SysEx stream.
+    using Handler = void (*)(BasicPort* port, Transport* transport, Packet* packet);
+    struct Dispatch {
+      uint32_t Counter::*counter;
+      Handler            handle;
+    };
+
+    static void dispatchInvalid(BasicPort* port, Transport* transport, Packet* packet) {
+      port->_sysex.in.reset();
+    }
+
+    static void dispatchPacket(BasicPort* port, Packet* packet) {
+      port->_sysex.in.reset();
+      if constexpr (Handles::packet)
+        port->derived()->handlePacket(packet);
+    }
+
+    static void dispatchNoteOff(BasicPort* port, Transport* transport, Packet* packet) {
+      dispatchPacket(port, packet);
+      if constexpr (Handles::noteOff)
+        port->derived()->handleNoteOff(packet->getChannel(), packet->getNote(), packet->getNoteVelocity());
+    }
+
+    static void dispatchNote(BasicPort* port, Transport* transport, Packet* packet) {
+      dispatchPacket(port, packet);
+      if constexpr (Handles::note)
+        port->derived()->handleNote(packet->getChannel(), packet->getNote(), packet->getNoteVelocity());
+    }
+
+    static void dispatchAftertouch(BasicPort* port, Transport* transport, Packet* packet) {
+      dispatchPacket(port, packet);
+      if constexpr (Handles::aftertouch)
+        port->derived()->handleAftertouch(packet->getChannel(),
+                                          packet->getAftertouchNote(),
+                                          packet->getAftertouch());
+    }
+
+    static void dispatchControlChange(BasicPort* port, Transport* transport, Packet* packet) {
+      dispatchPacket(port, packet);
+      if constexpr (Handles::control)
+        port->derived()->handleControlChange(packet->getChannel(),
+                                             packet->getController(),
+                                             packet->getControllerValue());
+    }
+
+    static void dispatchProgramChange(BasicPort* port, Transport* transport, Packet* packet) {
+      dispatchPacket(port, packet);
+      if constexpr (Handles::program)
+        port->derived()->handleProgramChange(packet->getChannel(), packet->getProgram());
+    }
+
+    static void dispatchAftertouchChannel(BasicPort* port, Transport* transport, Packet* packet) {
+      dispatchPacket(port, packet);
+      if constexpr (Handles::aftertouchChannel)
+        port->derived()->handleAftertouchChannel(packet->getChannel(), packet->getAftertouchChannel());
+    }
+
+    static void dispatchPitchBend(BasicPort* port, Transport* transport, Packet* packet) {
+      dispatchPacket(port, packet);
+      if constexpr (Handles::pitchbend)
+        port->derived()->handlePitchBend(packet->getChannel(), packet->getPitchBend());
+    }
+
+    static void dispatchSystemCommon(BasicPort* port, Transport* transport, Packet* packet) {
+      dispatchPacket(port, packet);
+
+      switch (packet->getType()) {
+        case Packet::Status::SystemSongPosition:
+          if constexpr (Handles::songPosition)
+            port->derived()->handleSongPosition(packet->getSongPosition());
+          break;
+
+        case Packet::Status::SystemSongSelect:
+          if constexpr (Handles::songSelect)
+            port->derived()->handleSongSelect(packet->getSongSelect());
+          break;
+      }
+    }
+
+    static void dispatchSingleByte(BasicPort* port, Transport* transport, Packet* packet) {
+      // Single byte in the middle of a SysEx stream.
+      if (!port->storeSystemExclusive(packet))
+        return;
+
+      if constexpr (Handles::packet)
+        port->derived()->handlePacket(packet);
+
+      switch (packet->getType()) {
+        case Packet::Status::SystemClock:
+          if constexpr (Handles::clock) {
+            port->_statistics.input.system.clock.tick++;
+            port->derived()->handleClock(Clock::Event::Tick);
+          }
+          break;
+
+        case Packet::Status::SystemStart:
+          if constexpr (Handles::clock)
+            port->derived()->handleClock(Clock::Event::Start);
+          break;
+
+        case Packet::Status::SystemContinue:
+          if constexpr (Handles::clock)
+            port->derived()->handleClock(Clock::Event::Continue);
+          break;
+
+        case Packet::Status::SystemStop:
+          if constexpr (Handles::clock)
+            port->derived()->handleClock(Clock::Event::Stop);
+          break;
+
+        case Packet::Status::SystemReset:
+          if constexpr (Handles::reset) {
+            port->_statistics.input.system.reset++;
+            port->derived()->handleSystemReset();
+          }
+          break;
+      }
+    }
+
+    static void dispatchSystemExclusive(BasicPort* port, Transport* transport, Packet* packet) {
+      if (!port->storeSystemExclusive(packet))
+        return;
+
+      if (port->_sysex.in.stream.buffer) {
+        if constexpr (Handles::exclusiveChunk) {
+          port->_statistics.input.system.exclusive++;
+          port->flushSystemExclusiveStream(true);
+        }
+
+        port->_sysex.in.reset();
+        return;
+      }
+
+      if constexpr (Handles::exclusive || Handles::exclusiveTransport)
+        port->_statistics.input.system.exclusive++;
+
+      if constexpr (Handles::exclusiveTransport)
+        port->derived()->handleSystemExclusive(transport, port->_sysex.in.buffer, port->_sysex.in.length);
+
+      if constexpr (Handles::exclusive)
+        port->derived()->handleSystemExclusive(port->_sysex.in.buffer, port->_sysex.in.length);
+    }
+
+    // Channel messages without a handler only update the SysEx state.
+    template <bool handled> static constexpr Dispatch channel(uint32_t Counter::*counter, Handler handle) {
+      if (handled || Handles::packet)
+        return {handled ? counter : NULL, handle};
+
+      return {NULL, dispatchInvalid};
+    }
+
+    // Indexed by the code index number of the packet, Packet::CodeIndex.
+    static constexpr Dispatch _dispatch[16]{
+      {NULL, dispatchInvalid},
+      {NULL, dispatchInvalid},
+      {NULL, dispatchSystemCommon},
+      {NULL, dispatchSystemCommon},
+      {NULL, dispatchSystemExclusive},
+      {NULL, dispatchSystemExclusive},
+      {NULL, dispatchSystemExclusive},
+      {NULL, dispatchSystemExclusive},
+      channel<Handles::noteOff>(&Counter::noteOff, dispatchNoteOff),
+      channel<Handles::note>(&Counter::note, dispatchNote),
+      channel<Handles::aftertouch>(&Counter::aftertouch, dispatchAftertouch),
+      channel<Handles::control>(&Counter::control, dispatchControlChange),
+      channel<Handles::program>(&Counter::program, dispatchProgramChange),
+      channel<Handles::aftertouchChannel>(&Counter::aftertouchChannel, dispatchAftertouchChannel),
+      channel<Handles::pitchbend>(&Counter::pitchbend, dispatchPitchBend),
+      {NULL, dispatchSingleByte},
+    };
+  };
+
+  // Port with virtual handlers.
+  class Port : public BasicPort<Port> {
+  public:
+    Port() = delete;
+    constexpr Port(uint8_t index, uint32_t sysexSize) : BasicPort(index, sysexSize) {}
+    virtual ~Port() = default;
+
+  protected:
+    friend class BasicPort<Port>;
+
+    virtual void handleNote(uint8_t channel, uint8_t note, uint8_t velocity) {}
+    virtual void handleNoteOff(uint8_t channel, uint8_t note, uint8_t velocity) {}
+    virtual void handleAftertouch(uint8_t channel, uint8_t note, uint8_t pressure) {}
+    virtual void handleControlChange(uint8_t channel, uint8_t controller, uint8_t value) {}
+    virtual void handleProgramChange(uint8_t channel, uint8_t value) {}
+    virtual void handleAftertouchChannel(uint8_t channel, uint8_t pressure) {}
+    virtual void handlePitchBend(uint8_t channel, int16_t value) {}
+    virtual void handleSongPosition(uint16_t beats){};
+    virtual void handleSongSelect(uint8_t number){};
+    virtual void handleClock(Clock::Event clock) {}
+    virtual void handleSystemExclusive(const uint8_t* buffer, uint32_t len) {}
+    virtual void handleSystemReset() {}
+    virtual void handleSwitchChannel(uint8_t channel) {}
+
+    // All messages besides system exclusive.
+    virtual void handlePacket(Packet* packet) {}
+
+    // During dispatch, replies are sent back to the originating transport.
+    virtual void handleSystemExclusive(Transport* transport, const uint8_t* buffer, uint32_t len) {}
+
+    // Incoming SysEx messages in chunks, see setSystemExclusiveStream().
+    virtual void handleSystemExclusiveChunk(uint32_t offset, const uint8_t* data, uint32_t len, bool final) {}
+
+    virtual bool handleSend(Packet* packet) {
+      return false;
+    }
+  };
+
+  // Port with static SysEx buffers. Several ports can share one outgoing buffer
+  // by passing it to begin(), 'outSize' should be 0 then.
+  template <uint32_t inSize, uint32_t outSize = inSize> class StaticPort : public Port {
+  public:
+    constexpr StaticPort(uint8_t index) : Port(index, inSize) {}
+
+    void begin() {
+      Port::begin(&_in, &_out);
+    }
+
+    void begin(SystemExclusiveBuffer* out) {
+      Port::begin(&_in, out);
+    }
+
+  private:
+    StaticSystemExclusiveBuffer<inSize>  _in;
+    StaticSystemExclusiveBuffer<outSize> _out;
   };
 };
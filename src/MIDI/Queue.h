@@ -0,0 +1,148 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "Packet.h"
+#include "Transport.h"
+#include <atomic>
+
+namespace V2MIDI {
+  // Fixed-size packet queue with a single producer and a single consumer, like an
+  // interrupt handler and the main loop. It uses atomic loads and stores only, no
+  // locks; the size needs to be a power of two.
+  template <uint16_t size> class Queue {
+    static_assert(size > 0 && (size & (size - 1)) == 0, "Size needs to be a power of two");
+
+  public:
+    // Only updated by the producer, the values might be read from any context.
+    struct Counter {
+      std::atomic<uint32_t> packet;
+      std::atomic<uint32_t> overflow;
+    };
+
+    // Producer.
+    bool push(const Packet* packet) {
+      const uint32_t head = _head.load(std::memory_order_relaxed);
+      if (head - _tail.load(std::memory_order_acquire) == size) {
+        increment(_statistics.overflow);
+        return false;
+      }
+
+      _packets[head & (size - 1)] = *packet;
+      _head.store(head + 1, std::memory_order_release);
+      increment(_statistics.packet);
+      return true;
+    }
+
+    // Consumer.
+    bool pop(Packet* packet) {
+      const uint32_t tail = _tail.load(std::memory_order_relaxed);
+      if (tail == _head.load(std::memory_order_acquire))
+        return false;
+
+      *packet = _packets[tail & (size - 1)];
+      _tail.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+
+    size_t pop(Packet* packets, size_t max) {
+      const uint32_t tail = _tail.load(std::memory_order_relaxed);
+      uint32_t       n    = _head.load(std::memory_order_acquire) - tail;
+      if (n > max)
+        n = max;
+
+      for (uint32_t i = 0; i < n; i++)
+        packets[i] = _packets[(tail + i) & (size - 1)];
+
+      _tail.store(tail + n, std::memory_order_release);
+      return n;
+    }
+
+    uint32_t getCount() const {
+      return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+    }
+
+    const Counter& getStatistics() const {
+      return _statistics;
+    }
+
+  private:
+    Packet                _packets[size]{};
+    std::atomic<uint32_t> _head{};
+    std::atomic<uint32_t> _tail{};
+    Counter               _statistics{};
+
+    // Single writer, no read-modify-write instruction needed.
+    static void increment(std::atomic<uint32_t>& counter) {
+      counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+  };
+
+  // Decouple a transport from the main loop. Packets are moved between the wrapped
+  // transport and the queues in interrupt context; receive() and send() only
+  // access the queues.
+  template <uint16_t size = 64> class QueuedTransport : public Transport {
+  public:
+    constexpr QueuedTransport(Transport* transport) : _transport(transport) {}
+
+    // Called from the receive interrupt with a complete packet.
+    bool queueReceived(const Packet* packet) {
+      return _input.push(packet);
+    }
+
+    // Called from interrupt context, moves the received packets of the wrapped
+    // transport into the queue.
+    void pollReceive() {
+      Packet packet;
+      while (_input.getCount() < size && _transport->receive(&packet))
+        _input.push(&packet);
+    }
+
+    // Called from interrupt context, sends the queued packets over the wrapped
+    // transport.
+    void pollSend() {
+      for (;;) {
+        if (!_pending && !_output.pop(&_packet))
+          return;
+
+        // Keep the refused packet for the next call.
+        _pending = !_transport->send(&_packet);
+        if (_pending)
+          return;
+      }
+    }
+
+    using Transport::receive;
+    using Transport::send;
+
+    bool receive(Packet* packet) {
+      return _input.pop(packet);
+    }
+
+    size_t receive(Packet* packets, size_t max) {
+      return _input.pop(packets, max);
+    }
+
+    bool send(Packet* packet) {
+      return _output.push(packet);
+    }
+
+    const Queue<size>& getInput() const {
+      return _input;
+    }
+
+    const Queue<size>& getOutput() const {
+      return _output;
+    }
+
+  private:
+    Transport*  _transport;
+    Queue<size> _input;
+    Queue<size> _output;
+
+    // A packet refused by the wrapped transport.
+    Packet _packet{};
+    bool   _pending{};
+  };
+}
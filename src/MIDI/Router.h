@@ -0,0 +1,202 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "Packet.h"
+#include "Transport.h"
+#include <array>
+
+namespace V2MIDI {
+  // Forward packets to up to 16 outputs. The destinations are looked up in a routing
+  // matrix, indexed by the virtual port of the packet, its channel and the class of
+  // the message.
+  class Router {
+  public:
+    // Messages which can be routed independently.
+    enum class Class : uint8_t {
+      Note,
+      Aftertouch,
+      Control,
+      Program,
+      PitchBend,
+      System,
+      Exclusive,
+      RealTime, // Clock, Start, Continue, Stop, Active Sensing, Reset
+    };
+
+    // The routing matrix holds a bitmask of outputs for every port, channel and class.
+    // System messages carry no channel, their routes are stored for all channels.
+    // Fixed setups can create the matrix at compile time and keep it in flash.
+    class Matrix {
+    public:
+      // Add the 'outputs' to the routes of the 'classes' of the 'channels'; all three
+      // are bitmasks.
+      constexpr Matrix* connect(uint8_t port, uint16_t channels, uint8_t classes, uint16_t outputs) {
+        update(port, channels, classes, outputs, 0xffff);
+        return this;
+      }
+
+      constexpr Matrix* disconnect(uint8_t port, uint16_t channels, uint8_t classes, uint16_t outputs) {
+        update(port, channels, classes, 0, ~outputs);
+        return this;
+      }
+
+      constexpr void clear() {
+        _routes = {};
+      }
+
+      constexpr uint16_t get(uint8_t port, uint8_t channel, Class type) const {
+        return _routes[getIndex(port, channel, static_cast<uint8_t>(type))];
+      }
+
+      // The outputs of a packet.
+      constexpr uint16_t get(const Packet* packet) const {
+        uint8_t type = _classes[static_cast<uint8_t>(packet->getCodeIndex())];
+        if (type == _classInvalid)
+          return 0;
+
+        // A single byte packet carries a real-time message, a Tune Request, or a
+        // data byte of a SysEx message.
+        if (packet->getCodeIndex() == Packet::CodeIndex::SingleByte) {
+          if (packet->isRealTime())
+            type = static_cast<uint8_t>(Class::RealTime);
+          else if (packet->getByte(1) & 0x80)
+            type = static_cast<uint8_t>(Class::System);
+          else
+            type = static_cast<uint8_t>(Class::Exclusive);
+        }
+
+        return _routes[getIndex(packet->getPort(), packet->getChannel(), type)];
+      }
+
+    private:
+      std::array<uint16_t, 16 * 16 * 8> _routes{};
+
+      static constexpr uint16_t getIndex(uint8_t port, uint8_t channel, uint8_t type) {
+        return (port & 0x0f) << 7 | (channel & 0x0f) << 3 | type;
+      }
+
+      constexpr void update(uint8_t port, uint16_t channels, uint8_t classes, uint16_t set, uint16_t keep) {
+        for (uint8_t type = 0; type < 8; type++) {
+          if (!(classes & (1 << type)))
+            continue;
+
+          // The channel bits of system messages carry other data.
+          const uint16_t mask = type >= static_cast<uint8_t>(Class::System) ? 0xffff : channels;
+          for (uint8_t channel = 0; channel < 16; channel++) {
+            if (!(mask & (1 << channel)))
+              continue;
+
+            uint16_t& routes = _routes[getIndex(port, channel, type)];
+            routes           = (routes & keep) | set;
+          }
+        }
+      }
+    };
+
+    struct {
+      uint32_t input{};
+      uint32_t output{};
+
+      // Packets without a route.
+      uint32_t unrouted{};
+
+      // Packets which were refused by the output transport.
+      uint32_t dropped{};
+    } statistics;
+
+    constexpr Router(const Matrix* matrix) : _matrix(matrix) {}
+
+    // The matrix can be switched or edited at runtime.
+    void setMatrix(const Matrix* matrix) {
+      _matrix = matrix;
+    }
+
+    // Packets forwarded to the output carry the given virtual port number.
+    bool setOutput(uint8_t index, Transport* transport, uint8_t port = 0) {
+      if (index >= _maxOutputs)
+        return false;
+
+      _outputs[index] = {transport, port};
+      return true;
+    }
+
+    // Send a packet to all its outputs, returns the number of outputs.
+    uint8_t forward(const Packet* packet) {
+      statistics.input++;
+
+      uint16_t outputs = _matrix->get(packet);
+      if (outputs == 0) {
+        statistics.unrouted++;
+        return 0;
+      }
+
+      uint8_t n = 0;
+      while (outputs) {
+        const uint8_t index = __builtin_ctz(outputs);
+        outputs &= outputs - 1;
+
+        const Output& output = _outputs[index];
+        if (!output.transport)
+          continue;
+
+        Packet midi = *packet;
+        midi.setPort(output.port);
+        if (!output.transport->send(&midi)) {
+          statistics.dropped++;
+          continue;
+        }
+
+        statistics.output++;
+        n++;
+      }
+
+      return n;
+    }
+
+    // Forward all pending packets of a transport.
+    void loop(Transport* transport) {
+      for (;;) {
+        Packet packets[16];
+        const size_t n = transport->receive(packets, 16);
+        for (size_t i = 0; i < n; i++)
+          forward(packets + i);
+
+        if (n < 16)
+          break;
+      }
+    }
+
+  private:
+    static constexpr uint8_t _maxOutputs{16};
+    static constexpr uint8_t _classInvalid{0xff};
+
+    // The message class of every code index.
+    static constexpr uint8_t _classes[16]{
+      _classInvalid,
+      _classInvalid,
+      static_cast<uint8_t>(Class::System),
+      static_cast<uint8_t>(Class::System),
+      static_cast<uint8_t>(Class::Exclusive),
+      static_cast<uint8_t>(Class::Exclusive),
+      static_cast<uint8_t>(Class::Exclusive),
+      static_cast<uint8_t>(Class::Exclusive),
+      static_cast<uint8_t>(Class::Note),
+      static_cast<uint8_t>(Class::Note),
+      static_cast<uint8_t>(Class::Aftertouch),
+      static_cast<uint8_t>(Class::Control),
+      static_cast<uint8_t>(Class::Program),
+      static_cast<uint8_t>(Class::Aftertouch),
+      static_cast<uint8_t>(Class::PitchBend),
+      static_cast<uint8_t>(Class::RealTime),
+    };
+
+    const Matrix* _matrix;
+
+    struct Output {
+      Transport* transport;
+      uint8_t    port;
+    } _outputs[_maxOutputs]{};
+  };
+};
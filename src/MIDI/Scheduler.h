@@ -0,0 +1,128 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "Packet.h"
+#include "Port.h"
+#include "Transport.h"
+
+namespace V2MIDI {
+  // Interleave the outgoing SysEx messages of several ports over one shared transport.
+  // The ports are served round-robin, every port sends up to 'priority' packets per
+  // round. Real-time messages are sent ahead of the next SysEx packet.
+  //
+  // Any BasicPort can be added, like a Port or a port with handlers resolved at
+  // compile time; ports of different types can share one scheduler.
+  class Scheduler {
+  public:
+    constexpr Scheduler(Transport* transport) : _transport(transport) {}
+
+    template <typename Derived> bool add(BasicPort<Derived>* port, uint8_t priority = 1) {
+      if (_nPorts == _maxPorts)
+        return false;
+
+      if (priority == 0)
+        return false;
+
+      _ports[_nPorts++] = {port, &_calls<Derived>, priority, 0};
+      return true;
+    }
+
+    // Queue the message in the port's SysEx buffer, it is sent with loop().
+    template <typename Derived> bool sendSystemExclusive(BasicPort<Derived>* port, uint32_t length) {
+      return port->queueSystemExclusive(_transport, length);
+    }
+
+    // Send a real-time message through the real-time lane of the port, it is not
+    // blocked by an ongoing SysEx transfer. If the transport is busy, the packet is
+    // sent with the next loop() before any other SysEx packet. Other messages are
+    // refused.
+    template <typename Derived> bool sendRealTime(BasicPort<Derived>* port, Packet* packet) {
+      return port->sendRealTime(_transport, packet);
+    }
+
+    // Send packets until the transport is busy or all messages are sent. Returns
+    // if there are remaining packets.
+    bool loop() {
+      for (;;) {
+        if (!flushRealTime())
+          return true;
+
+        bool pending{};
+        for (uint8_t n = 0; n < _nPorts; n++) {
+          auto& entry = _ports[_next];
+
+          if (entry.calls->isSending(entry.port)) {
+            pending = true;
+
+            while (entry.sent < entry.priority) {
+              if (!flushRealTime())
+                return true;
+
+              // The transport is busy, continue with the same port.
+              const int8_t r = entry.calls->loop(entry.port);
+              if (r < 0)
+                return true;
+
+              entry.sent++;
+              if (r == 0)
+                break;
+            }
+          }
+
+          entry.sent = 0;
+          _next      = (_next + 1) % _nPorts;
+        }
+
+        if (!pending)
+          return false;
+      }
+    }
+
+  private:
+    static constexpr uint8_t _maxPorts{16};
+    Transport*               _transport;
+
+    // The calls into the ports, one table per port type.
+    struct Calls {
+      bool (*isSending)(void* port);
+      int8_t (*loop)(void* port);
+      bool (*flushRealTime)(void* port);
+    };
+
+    template <typename Derived> static bool isSendingPort(void* port) {
+      return static_cast<BasicPort<Derived>*>(port)->isSendingSystemExclusive();
+    }
+
+    template <typename Derived> static int8_t loopPort(void* port) {
+      return static_cast<BasicPort<Derived>*>(port)->loopSystemExclusive();
+    }
+
+    template <typename Derived> static bool flushPort(void* port) {
+      return static_cast<BasicPort<Derived>*>(port)->flushRealTime();
+    }
+
+    template <typename Derived>
+    static constexpr Calls _calls{isSendingPort<Derived>, loopPort<Derived>, flushPort<Derived>};
+
+    struct {
+      void*        port;
+      const Calls* calls;
+      uint8_t      priority;
+      uint8_t      sent;
+    } _ports[_maxPorts]{};
+    uint8_t _nPorts{};
+    uint8_t _next{};
+
+    // The queued real-time messages of all ports.
+    bool flushRealTime() {
+      for (uint8_t i = 0; i < _nPorts; i++) {
+        if (!_ports[i].calls->flushRealTime(_ports[i].port))
+          return false;
+      }
+
+      return true;
+    }
+  };
+}
@@ -4,175 +4,251 @@
 #pragma once
 
 #include "Packet.h"
+#include "SerialParser.h"
+#include "SerialStream.h"
+#include "Time.h"
 #include "Transport.h"
-#include <V2Base.h>
 
 namespace V2MIDI {
   class SerialDevice : public Transport {
   public:
+    struct Counter {
+      uint32_t packet;
+      uint32_t note;
+      uint32_t noteOff;
+      uint32_t aftertouch;
+      uint32_t control;
+      uint32_t program;
+      uint32_t aftertouchChannel;
+      uint32_t pitchbend;
+      struct {
+        struct {
+          uint32_t tick;
+        } clock;
+        uint32_t exclusive;
+        uint32_t exclusiveBytes;
+        uint32_t reset;
+      } system;
+
+      // The number of bytes on the wire.
+      uint32_t bytes;
+    };
+
     struct {
-      uint32_t input{};
-      uint32_t output{};
-    } statistics;
+      Counter input;
+      Counter output;
+
+      // Incomplete messages and undefined status bytes.
+      uint32_t error;
+
+      // Data bytes without a status byte.
+      uint32_t dropped;
+    } statistics{};
+
+    constexpr SerialDevice(SerialStream* stream) : _stream(stream) {}
 
-    constexpr SerialDevice(Uart* uart) : _uart(uart) {}
+#ifdef ARDUINO
+    constexpr SerialDevice(Uart* uart) : _uart(uart), _stream(&_uart) {}
+#endif
 
     void begin() {
-      _uart->begin(31250);
-      _uart->setTimeout(1);
+      _stream->begin();
+    }
+
+    // Running Status omits the status byte of channel messages if it is identical
+    // to the previous one. It is sent again after 'refreshUsec', to allow a receiver
+    // which has missed it, to synchronize.
+    void setRunningStatus(bool enable, uint32_t refreshUsec = 500 * 1000) {
+      _running.enable      = enable;
+      _running.refreshUsec = refreshUsec;
+      _running.status      = 0;
     }
 
     bool send(Packet* midi) {
-      switch (midi->getType()) {
-        case Packet::Status::NoteOn:
-        case Packet::Status::NoteOff:
-        case Packet::Status::Aftertouch:
-        case Packet::Status::ControlChange:
-        case Packet::Status::PitchBend:
-        case Packet::Status::SystemSongPosition:
-          return _uart->write(midi->_data + 1, 3);
-          statistics.output++;
-          return true;
+      // System Exclusive packets carry a fixed number of bytes of the message,
+      // they are written unmodified.
+      uint8_t length;
+      switch (midi->getCodeIndex()) {
+        case Packet::CodeIndex::SystemExclusiveStart:
+        case Packet::CodeIndex::SystemExclusiveEnd3:
+          length = 3;
+          break;
 
-        case Packet::Status::ProgramChange:
-        case Packet::Status::AftertouchChannel:
-        case Packet::Status::SystemTimeCodeQuarterFrame:
-        case Packet::Status::SystemSongSelect:
-          return _uart->write(midi->_data + 1, 2);
-          statistics.output++;
-          return true;
+        case Packet::CodeIndex::SystemExclusiveEnd2:
+          length = 2;
+          break;
 
-        case Packet::Status::SystemTuneRequest:
-        case Packet::Status::SystemClock:
-        case Packet::Status::SystemStart:
-        case Packet::Status::SystemContinue:
-        case Packet::Status::SystemStop:
-        case Packet::Status::SystemActiveSensing:
-        case Packet::Status::SystemReset:
-          return _uart->write(midi->_data[1]);
-          statistics.output++;
-          return true;
+        case Packet::CodeIndex::SystemExclusiveEnd1:
+        case Packet::CodeIndex::SingleByte:
+          length = 1;
+          break;
 
-        // System Exclusive is only handled right now.
-        case Packet::Status::SystemExclusive:
-          return false;
+        default:
+          length = Packet::getLength(midi->getType());
+          if (length == 0)
+            return false;
       }
 
-      return false;
-    }
+      const uint8_t* data = midi->getData() + 1;
 
-    bool receive(Packet* midi) {
-      if (_uart->available() == 0)
-        return false;
+      // Any system message, including Real-Time, cancels Running Status. Not all
+      // receivers keep it across interleaved messages.
+      const Packet::CodeIndex codeIndex = midi->getCodeIndex();
+      if (codeIndex < Packet::CodeIndex::NoteOff || codeIndex > Packet::CodeIndex::PitchBend)
+        _running.status = 0;
 
-      uint8_t b = _uart->read();
-
-      if (b & 0x80) {
-        switch (b) {
-          // Real-Time messages do not update the current Running Status. Do not process,
-          // forward them immediately.
-          case (uint8_t)Packet::Status::SystemClock:
-          case (uint8_t)Packet::Status::SystemStart:
-          case (uint8_t)Packet::Status::SystemContinue:
-          case (uint8_t)Packet::Status::SystemStop:
-          case (uint8_t)Packet::Status::SystemActiveSensing:
-          case (uint8_t)Packet::Status::SystemReset:
-            midi->set(0, (Packet::Status)b, 0, 0);
-            statistics.input++;
-            return true;
+      else if (_running.enable) {
+        if (data[0] == _running.status && Time::getUsec() - _running.usec < _running.refreshUsec) {
+          data++;
+          length--;
+
+        } else {
+          _running.status = data[0];
+          _running.usec   = Time::getUsec();
         }
+      }
 
-        _state = State::Status;
+      if (_stream->write(data, length) != length) {
+        // The state of the receiver is unknown.
+        _running.status = 0;
+        return false;
       }
 
-      switch (_state) {
-        case State::Idle:
-          return false;
-
-        case State::Status: {
-          _status  = Packet::getStatus(b);
-          _channel = b & 0x0f;
-          switch (_status) {
-            // Single byte message, the Real-Time messages are already handled.
-            case Packet::Status::SystemTuneRequest:
-              midi->set(0, _status, 0, 0);
-              _state = State::Idle;
-              statistics.input++;
-              return true;
-
-            // Wait for next byte.
-            case Packet::Status::ProgramChange:
-            case Packet::Status::AftertouchChannel:
-            case Packet::Status::SystemTimeCodeQuarterFrame:
-            case Packet::Status::SystemSongSelect:
-            case Packet::Status::NoteOn:
-            case Packet::Status::NoteOff:
-            case Packet::Status::ControlChange:
-            case Packet::Status::PitchBend:
-            case Packet::Status::SystemSongPosition:
-              _state = State::Data1;
-              return false;
-
-            case Packet::Status::SystemExclusive:
-              _state = State::SysEx;
-              return false;
-          }
-
-        } break;
-
-        case State::Data1:
-          switch (_status) {
-            // Two bytes message.
-            case Packet::Status::ProgramChange:
-            case Packet::Status::AftertouchChannel:
-            case Packet::Status::SystemTimeCodeQuarterFrame:
-            case Packet::Status::SystemSongSelect:
-              midi->set(_channel, _status, b, 0);
-              _state = State::Idle;
-              statistics.input++;
-              return true;
-
-            // Wait for next byte.
-            case Packet::Status::NoteOn:
-            case Packet::Status::NoteOff:
-            case Packet::Status::Aftertouch:
-            case Packet::Status::ControlChange:
-            case Packet::Status::PitchBend:
-            case Packet::Status::SystemSongPosition:
-              _data1 = b;
-              _state = State::Data2;
-              return false;
-          }
-          break;
+      countPacket(&statistics.output, midi);
+      statistics.output.bytes += length;
+      return true;
+    }
 
-        case State::Data2:
-          midi->set(_channel, _status, _data1, b);
-          _state = State::Idle;
-          statistics.input++;
+    // Parse the available bytes until a packet is complete.
+    bool receive(Packet* midi) {
+      uint8_t b;
+      while (_stream->available() > 0 && _stream->read(&b, 1) == 1) {
+        statistics.input.bytes++;
+        if (_parser.parse(b, midi)) {
+          countPacket(&statistics.input, midi);
+          countErrors();
           return true;
-
-        case State::SysEx:
-          // System Exclusive is not processed right now. Just discard  the bytes
-          // until the next status byte arrives.
-          return false;
+        }
       }
 
+      countErrors();
       return false;
     }
 
+    // Parse all bytes which are available in the stream. A byte completes at most
+    // one packet; reading not more bytes than there are free packets ensures that all
+    // read bytes are parsed.
+    size_t receive(Packet* packets, size_t max) {
+      size_t n = 0;
+      while (n < max) {
+        uint8_t buffer[64];
+        size_t  length = _stream->available();
+        if (length == 0)
+          break;
+
+        if (length > sizeof(buffer))
+          length = sizeof(buffer);
+
+        if (length > max - n)
+          length = max - n;
+
+        length = _stream->read(buffer, length);
+        if (length == 0)
+          break;
+
+        statistics.input.bytes += length;
+        const size_t parsed = _parser.parse(buffer, length, packets + n, max - n);
+        for (size_t i = 0; i < parsed; i++)
+          countPacket(&statistics.input, packets + n + i);
+
+        n += parsed;
+      }
+
+      countErrors();
+      return n;
+    }
+
+    size_t send(const Packet* packets, size_t count) {
+      for (size_t i = 0; i < count; i++) {
+        Packet packet = packets[i];
+        if (!SerialDevice::send(&packet))
+          return i;
+      }
+
+      return count;
+    }
+
   private:
-    enum class State {
-      Idle,
-      Status,
-      Data1,
-      Data2,
-      SysEx,
-    } _state{};
-
-    uint8_t        _channel{};
-    Packet::Status _status{};
-    uint8_t        _data1{};
-
-    Uart* _uart;
+    SerialParser _parser;
+
+    // The last status byte written to the wire.
+    struct {
+      bool     enable{};
+      uint32_t refreshUsec{};
+      uint8_t  status{};
+      uint32_t usec{};
+    } _running;
+
+#ifdef ARDUINO
+    UartStream _uart{NULL};
+#endif
+    SerialStream* _stream;
+
+    // The counters of the channel messages, indexed by the code index.
+    static constexpr uint32_t Counter::*_counters[16]{
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      &Counter::noteOff,
+      &Counter::note,
+      &Counter::aftertouch,
+      &Counter::control,
+      &Counter::program,
+      &Counter::aftertouchChannel,
+      &Counter::pitchbend,
+      NULL,
+    };
+
+    static void countPacket(Counter* counter, const Packet* midi) {
+      counter->packet++;
+
+      const Packet::CodeIndex codeIndex = midi->getCodeIndex();
+      if (uint32_t Counter::*channel = _counters[(uint8_t)codeIndex]) {
+        (counter->*channel)++;
+        return;
+      }
+
+      switch (codeIndex) {
+        case Packet::CodeIndex::SystemExclusiveStart:
+          counter->system.exclusiveBytes += 3;
+          break;
+
+        // The 'End' packets carry 1 to 3 bytes.
+        case Packet::CodeIndex::SystemExclusiveEnd1:
+        case Packet::CodeIndex::SystemExclusiveEnd2:
+        case Packet::CodeIndex::SystemExclusiveEnd3:
+          counter->system.exclusiveBytes += (uint8_t)codeIndex - (uint8_t)Packet::CodeIndex::SystemExclusiveStart;
+          counter->system.exclusive++;
+          break;
+
+        case Packet::CodeIndex::SingleByte:
+          if (midi->getType() == Packet::Status::SystemClock)
+            counter->system.clock.tick++;
+
+          else if (midi->getType() == Packet::Status::SystemReset)
+            counter->system.reset++;
+          break;
+      }
+    }
+
+    void countErrors() {
+      statistics.error   = _parser.statistics.error;
+      statistics.dropped = _parser.statistics.dropped;
+    }
   };
 };
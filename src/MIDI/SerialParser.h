@@ -0,0 +1,197 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "Packet.h"
+#include <cstddef>
+
+namespace V2MIDI {
+  // Conversion of a serial MIDI byte stream into packets. It does not depend on
+  // any hardware and can parse the bytes from a UART, a DMA buffer or a file.
+  class SerialParser {
+  public:
+    struct {
+      // Incomplete messages, interrupted by a status byte, and undefined status bytes.
+      uint32_t error{};
+
+      // Data bytes without a status byte.
+      uint32_t dropped{};
+    } statistics;
+
+    // Parse one byte, returns true if 'midi' contains a new packet.
+    bool parse(uint8_t b, Packet* midi) {
+      if (b & 0x80) {
+        // Real-Time messages do not update the current Running Status. Do not process,
+        // forward them immediately.
+        if (b >= (uint8_t)Packet::Status::SystemClock) {
+          if (midi->set(0, (Packet::Status)b, 0, 0))
+            return true;
+
+          statistics.error++;
+          return false;
+        }
+
+        // Any status byte terminates a System Exclusive message. If it is not the
+        // 'End', the message is incomplete and the buffered bytes are discarded.
+        if (_state == State::SysEx && b == (uint8_t)Packet::Status::SystemExclusiveEnd) {
+          _state = State::Idle;
+          addSystemExclusive(b);
+          storeSystemExclusive(midi);
+          return true;
+        }
+
+        if (_state == State::Data1 || _state == State::Data2 || _state == State::SysEx)
+          statistics.error++;
+
+        _state = State::Status;
+      }
+
+      switch (_state) {
+        case State::Idle:
+          statistics.dropped++;
+          return false;
+
+        case State::Status:
+          _status = Packet::getStatus(b);
+
+          // System messages carry their type instead of a channel number.
+          _channel = _status >= Packet::Status::System ? 0 : b & 0x0f;
+
+          switch (Packet::getLength(_status)) {
+            // Single byte message, the Real-Time messages are already handled.
+            case 1:
+              midi->set(0, _status, 0, 0);
+              _state = State::Idle;
+              return true;
+
+            // Wait for next byte.
+            case 2:
+            case 3:
+              _state = State::Data1;
+              return false;
+          }
+
+          if (_status != Packet::Status::SystemExclusive) {
+            _state = State::Idle;
+            statistics.error++;
+            return false;
+          }
+
+          _state        = State::SysEx;
+          _sysex.length = 0;
+          addSystemExclusive(b);
+          return false;
+
+        case State::Running:
+        case State::Data1:
+          // Two bytes message.
+          if (Packet::getLength(_status) == 2) {
+            midi->set(_channel, _status, b, 0);
+            _state = runningState();
+            return true;
+          }
+
+          // Wait for next byte.
+          _data1 = b;
+          _state = State::Data2;
+          return false;
+
+        case State::Data2:
+          midi->set(_channel, _status, _data1, b);
+          _state = runningState();
+          return true;
+
+        case State::SysEx:
+          // Forward the message in chunks of three bytes, the 'End' packet carries
+          // the remaining bytes.
+          addSystemExclusive(b);
+          if (_sysex.length < 3)
+            return false;
+
+          storeSystemExclusive(midi);
+          return true;
+      }
+
+      return false;
+    }
+
+    // Parse a buffer of bytes, returns the number of packets stored in 'packets'.
+    // Parsing stops when 'max' packets are stored; the number of parsed bytes is
+    // returned in 'consumed'. Every byte results in at most one packet, with 'max'
+    // not smaller than 'n', all bytes are parsed.
+    size_t parse(const uint8_t* bytes, size_t n, Packet* packets, size_t max, size_t* consumed = NULL) {
+      size_t count = 0;
+      size_t i     = 0;
+      while (i < n && count < max) {
+        if (parse(bytes[i++], packets + count))
+          count++;
+      }
+
+      if (consumed)
+        *consumed = i;
+
+      return count;
+    }
+
+    void reset() {
+      _state = State::Idle;
+    }
+
+  private:
+    enum class State {
+      Idle,
+      Status,
+      Running,
+      Data1,
+      Data2,
+      SysEx,
+    } _state{};
+
+    uint8_t        _channel{};
+    Packet::Status _status{};
+    uint8_t        _data1{};
+
+    // The pending bytes of an incoming System Exclusive message.
+    struct {
+      uint8_t bytes[3];
+      uint8_t length;
+    } _sysex{};
+
+    // Data bytes following a complete channel message use the Running Status.
+    State runningState() const {
+      return _status < Packet::Status::System ? State::Running : State::Idle;
+    }
+
+    void addSystemExclusive(uint8_t b) {
+      _sysex.bytes[_sysex.length++] = b;
+    }
+
+    // Store the pending bytes in a packet. Three bytes without the 'End' are sent
+    // as 'Start', which is also used for all following chunks of the message.
+    void storeSystemExclusive(Packet* midi) {
+      uint8_t codeIndex;
+      switch (_sysex.length) {
+        case 1:
+          codeIndex = (uint8_t)Packet::CodeIndex::SystemExclusiveEnd1;
+          break;
+
+        case 2:
+          codeIndex = (uint8_t)Packet::CodeIndex::SystemExclusiveEnd2;
+          break;
+
+        default:
+          codeIndex = _sysex.bytes[2] == (uint8_t)Packet::Status::SystemExclusiveEnd
+                        ? (uint8_t)Packet::CodeIndex::SystemExclusiveEnd3
+                        : (uint8_t)Packet::CodeIndex::SystemExclusiveStart;
+      }
+
+      uint32_t word = (midi->getWord() & 0xf0) | codeIndex;
+      for (uint8_t i = 0; i < _sysex.length; i++)
+        word |= (uint32_t)_sysex.bytes[i] << ((i + 1) * 8);
+
+      midi->setWord(word);
+      _sysex.length = 0;
+    }
+  };
+};
@@ -0,0 +1,154 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef ARDUINO
+  #include <V2Base.h>
+#else
+  #include <cerrno>
+  #include <sys/ioctl.h>
+  #include <termios.h>
+  #include <unistd.h>
+#endif
+
+namespace V2MIDI {
+  // The byte stream of a serial MIDI connection.
+  class SerialStream {
+  public:
+    virtual void begin() {}
+
+    // The number of bytes which can be read without blocking.
+    virtual size_t available() = 0;
+
+    // Read and write up to 'n' bytes without blocking, returns the number of
+    // transferred bytes.
+    virtual size_t read(uint8_t* bytes, size_t n)        = 0;
+    virtual size_t write(const uint8_t* bytes, size_t n) = 0;
+  };
+
+  // Bytes written to the stream are read back from it. It can be used to replay
+  // captured traffic, or to connect a sender and a receiver in the same process.
+  template <size_t size = 256> class LoopbackStream : public SerialStream {
+  public:
+    size_t available() {
+      return _count;
+    }
+
+    size_t read(uint8_t* bytes, size_t n) {
+      if (n > _count)
+        n = _count;
+
+      for (size_t i = 0; i < n; i++)
+        bytes[i] = _buffer[(_first + i) % size];
+
+      _first = (_first + n) % size;
+      _count -= n;
+      return n;
+    }
+
+    size_t write(const uint8_t* bytes, size_t n) {
+      if (n > size - _count)
+        n = size - _count;
+
+      for (size_t i = 0; i < n; i++)
+        _buffer[(_first + _count + i) % size] = bytes[i];
+
+      _count += n;
+      return n;
+    }
+
+  private:
+    std::array<uint8_t, size> _buffer{};
+    size_t                    _first{};
+    size_t                    _count{};
+  };
+
+#ifdef ARDUINO
+  // The UART of the board.
+  class UartStream : public SerialStream {
+  public:
+    constexpr UartStream(Uart* uart, uint32_t baud = 31250) : _uart(uart), _baud(baud) {}
+
+    void begin() {
+      _uart->begin(_baud);
+      _uart->setTimeout(1);
+    }
+
+    size_t available() {
+      return _uart->available();
+    }
+
+    size_t read(uint8_t* bytes, size_t n) {
+      return _uart->readBytes(bytes, n);
+    }
+
+    size_t write(const uint8_t* bytes, size_t n) {
+      return _uart->write(bytes, n);
+    }
+
+  private:
+    Uart*    _uart;
+    uint32_t _baud;
+  };
+
+#else
+  // A POSIX file descriptor; a serial port, a pseudo terminal, a pipe or a socket.
+  // Terminals are switched to raw mode, the baud rate is not changed.
+  class FileStream : public SerialStream {
+  public:
+    constexpr FileStream(int fd) : _fd(fd) {}
+
+    void begin() {
+      struct termios tio;
+      if (tcgetattr(_fd, &tio) < 0)
+        return;
+
+      cfmakeraw(&tio);
+      tio.c_cc[VMIN]  = 0;
+      tio.c_cc[VTIME] = 0;
+      tcsetattr(_fd, TCSANOW, &tio);
+    }
+
+    size_t available() {
+      int n;
+      if (ioctl(_fd, FIONREAD, &n) < 0)
+        return 0;
+
+      return n;
+    }
+
+    size_t read(uint8_t* bytes, size_t n) {
+      const ssize_t r = ::read(_fd, bytes, n);
+      if (r < 0)
+        return 0;
+
+      return r;
+    }
+
+    size_t write(const uint8_t* bytes, size_t n) {
+      size_t written = 0;
+      while (written < n) {
+        const ssize_t r = ::write(_fd, bytes + written, n - written);
+        if (r < 0) {
+          if (errno == EINTR)
+            continue;
+
+          break;
+        }
+
+        written += r;
+      }
+
+      return written;
+    }
+
+  private:
+    int _fd;
+  };
+#endif
+};
@@ -0,0 +1,267 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "Packet.h"
+
+// System Exclusive message conversion.
+namespace V2MIDI::SysEx {
+  // Convert a message, which starts with 0xf0 and ends with 0xf7, into USB MIDI
+  // packets. The conversion can be split into several calls; 'offset' is the
+  // position in the message and needs to be a multiple of 3. Returns the number
+  // of packets stored in 'packets', at most 'max'.
+  inline uint32_t packetize(const uint8_t* message,
+                            uint32_t       length,
+                            uint32_t       offset,
+                            uint8_t        port,
+                            Packet*        packets,
+                            uint32_t       max) {
+    if (offset >= length)
+      return 0;
+
+    const uint32_t header = (port & 0x0f) << 4;
+
+    // All packets besides the last one carry three bytes.
+    uint32_t nStart = (length - offset - 1) / 3;
+    if (nStart > max)
+      nStart = max;
+
+    // The bytes after the three bytes of the packet exist, load a word and shift
+    // the fourth byte out of it.
+    auto word = [header](const uint8_t* bytes) -> uint32_t {
+      uint32_t w;
+      memcpy(&w, bytes, 4);
+      return header | static_cast<uint8_t>(Packet::CodeIndex::SystemExclusiveStart) | w << 8;
+    };
+
+    const uint8_t* bytes = message + offset;
+    uint32_t       n     = 0;
+    for (; n + 4 <= nStart; n += 4, bytes += 12) {
+      packets[n].setWord(word(bytes));
+      packets[n + 1].setWord(word(bytes + 3));
+      packets[n + 2].setWord(word(bytes + 6));
+      packets[n + 3].setWord(word(bytes + 9));
+    }
+
+    for (; n < nStart; n++, bytes += 3)
+      packets[n].setWord(word(bytes));
+
+    if (n == max)
+      return n;
+
+    // The last packet with 1 to 3 bytes.
+    switch (message + length - bytes) {
+      case 1:
+        packets[n].setWord(header | static_cast<uint8_t>(Packet::CodeIndex::SystemExclusiveEnd1) | bytes[0] << 8);
+        break;
+
+      case 2:
+        packets[n].setWord(header | static_cast<uint8_t>(Packet::CodeIndex::SystemExclusiveEnd2) | bytes[0] << 8 |
+                           bytes[1] << 16);
+        break;
+
+      case 3:
+        packets[n].setWord(header | static_cast<uint8_t>(Packet::CodeIndex::SystemExclusiveEnd3) | bytes[0] << 8 |
+                           bytes[1] << 16 | (uint32_t)bytes[2] << 24);
+        break;
+    }
+
+    return n + 1;
+  }
+
+  // Copy the payload of consecutive SystemExclusiveStart packets, which carry three
+  // bytes of a message each, into 'buffer'. It stops at the first packet with a
+  // different code index, at the start of a new message, or when the buffer is full.
+  // Returns the number of packets copied.
+  inline uint32_t depacketize(const Packet* packets, uint32_t count, uint8_t* buffer, uint32_t size) {
+    if (count > size / 3)
+      count = size / 3;
+
+    // Four packets are loaded as two 64 bit words, two packets each. A data packet
+    // has the code index 4 in the lowest 4 bits, and not the status byte 0xf0 in the
+    // next 8 bits. After the XOR with these values, the code index bits are 0 and the
+    // status bits are not; adding 0xff00 to the status bits carries into bit 16.
+    constexpr uint64_t data  = 0x0000f0040000f004;
+    constexpr uint64_t index = 0x0000000f0000000f;
+    constexpr uint64_t type  = 0x0000ff000000ff00;
+    constexpr uint64_t carry = 0x0001000000010000;
+
+    // The second word is stored with 8 bytes, 2 of them past the 12 bytes.
+    uint32_t n = 0;
+    for (; n + 4 <= count && (n + 4) * 3 + 2 <= size; n += 4, buffer += 12) {
+      uint64_t q0;
+      uint64_t q1;
+      memcpy(&q0, packets + n, 8);
+      memcpy(&q1, packets + n + 2, 8);
+
+      const uint64_t x0 = q0 ^ data;
+      const uint64_t x1 = q1 ^ data;
+      const uint64_t t0 = (x0 & type) + type;
+      const uint64_t t1 = (x1 & type) + type;
+      if (((x0 | x1) & index) | (~(t0 & t1) & carry))
+        break;
+
+      // Remove the code index byte of both packets.
+      const uint64_t b0 = (q0 >> 8 & 0xffffff) | (q0 >> 16 & 0xffffff000000);
+      const uint64_t b1 = (q1 >> 8 & 0xffffff) | (q1 >> 16 & 0xffffff000000);
+      memcpy(buffer, &b0, 8);
+      memcpy(buffer + 6, &b1, 8);
+    }
+
+    for (; n < count; n++, buffer += 3) {
+      const uint32_t word = packets[n].getWord();
+      if ((word & 0x0f) != static_cast<uint8_t>(Packet::CodeIndex::SystemExclusiveStart))
+        break;
+
+      if (((word >> 8) & 0xff) == static_cast<uint8_t>(Packet::Status::SystemExclusive))
+        break;
+
+      buffer[0] = word >> 8;
+      buffer[1] = word >> 16;
+      buffer[2] = word >> 24;
+    }
+
+    return n;
+  }
+
+  // The 7-bit encoding of 8-bit data. Every group of up to 7 bytes is preceded by a
+  // byte which carries the most significant bits of the group; bit 0 belongs to the
+  // first byte of the group.
+  constexpr uint32_t getEncodedSize(uint32_t length) {
+    return length + (length + 6) / 7;
+  }
+
+  constexpr uint32_t getDecodedSize(uint32_t length) {
+    return length - (length + 7) / 8;
+  }
+
+  // Collect the most significant bits of the four bytes of a word into bits 0-3.
+  constexpr uint32_t gatherBits(uint32_t word) {
+    return ((word & 0x80808080) * 0x00204081) >> 28;
+  }
+
+  // Distribute bits 0-3 to the most significant bits of the four bytes of a word.
+  constexpr uint32_t spreadBits(uint32_t bits) {
+    return ((bits & 0x0f) * 0x10204080) & 0x80808080;
+  }
+
+  // Encode 'length' bytes of 'data' into 'buffer', which needs to provide
+  // getEncodedSize(length) bytes. Full groups are converted with two overlapping
+  // words. Returns the number of bytes stored.
+  inline uint32_t encode(const uint8_t* data, uint32_t length, uint8_t* buffer) {
+    uint8_t* const start = buffer;
+
+    for (; length >= 7; length -= 7, data += 7, buffer += 8) {
+      uint32_t w0;
+      uint32_t w1;
+      memcpy(&w0, data, 4);
+      memcpy(&w1, data + 3, 4);
+
+      buffer[0] = gatherBits(w0) | gatherBits(w1) << 3;
+      w0 &= 0x7f7f7f7f;
+      w1 &= 0x7f7f7f7f;
+      memcpy(buffer + 1, &w0, 4);
+      memcpy(buffer + 4, &w1, 4);
+    }
+
+    if (length > 0) {
+      buffer[0] = 0;
+      for (uint32_t i = 0; i < length; i++) {
+        buffer[0] |= (data[i] >> 7) << i;
+        buffer[1 + i] = data[i] & 0x7f;
+      }
+
+      buffer += 1 + length;
+    }
+
+    return buffer - start;
+  }
+
+  // Decode 'length' bytes of 7-bit encoded 'data' into 'buffer', which needs to
+  // provide getDecodedSize(length) bytes. Returns the number of bytes stored.
+  inline uint32_t decode(const uint8_t* data, uint32_t length, uint8_t* buffer) {
+    uint8_t* const start = buffer;
+
+    for (; length >= 8; length -= 8, data += 8, buffer += 7) {
+      uint32_t w0;
+      uint32_t w1;
+      memcpy(&w0, data + 1, 4);
+      memcpy(&w1, data + 4, 4);
+
+      w0 = (w0 & 0x7f7f7f7f) | spreadBits(data[0]);
+      w1 = (w1 & 0x7f7f7f7f) | spreadBits(data[0] >> 3);
+      memcpy(buffer, &w0, 4);
+      memcpy(buffer + 3, &w1, 4);
+    }
+
+    if (length > 1) {
+      for (uint32_t i = 0; i < length - 1; i++)
+        buffer[i] = (data[1 + i] & 0x7f) | ((data[0] >> i) & 1) << 7;
+
+      buffer += length - 1;
+    }
+
+    return buffer - start;
+  }
+
+  // Incrementally encode data into a buffer, like the one returned by
+  // Port::getSystemExclusiveBuffer(). The data can be added in pieces of any size,
+  // the result is identical to a single encode() of the entire data.
+  class Encoder {
+  public:
+    constexpr Encoder(uint8_t* buffer, uint32_t size) : _buffer(buffer), _size(size) {}
+
+    // Returns false and does not store anything, if the buffer is too small.
+    bool add(const uint8_t* data, uint32_t length) {
+      const uint32_t nGroups = (_index + length + 6) / 7 - (_index > 0 ? 1 : 0);
+      if (_length + length + nGroups > _size)
+        return false;
+
+      // Complete the current group.
+      for (; length > 0 && _index > 0; length--, data++)
+        addByte(*data);
+
+      const uint32_t full = length - length % 7;
+      _length += encode(data, full, _buffer + _length);
+
+      for (uint32_t i = full; i < length; i++)
+        addByte(data[i]);
+
+      return true;
+    }
+
+    // The number of bytes stored in the buffer.
+    uint32_t getLength() const {
+      return _length;
+    }
+
+    void reset() {
+      _length = 0;
+      _index  = 0;
+    }
+
+  private:
+    uint8_t* _buffer;
+    uint32_t _size;
+    uint32_t _length{};
+
+    // The position of the byte with the most significant bits of the current
+    // group, and the number of bytes already added to the group.
+    uint32_t _header{};
+    uint8_t  _index{};
+
+    void addByte(uint8_t byte) {
+      if (_index == 0) {
+        _header          = _length++;
+        _buffer[_header] = 0;
+      }
+
+      _buffer[_header] |= (byte >> 7) << _index;
+      _buffer[_length++] = byte & 0x7f;
+
+      if (++_index == 7)
+        _index = 0;
+    }
+  };
+}
@@ -0,0 +1,38 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <cstdint>
+
+#ifdef ARDUINO
+  #include <V2Base.h>
+#else
+  #include <chrono>
+#endif
+
+namespace V2MIDI::Time {
+#ifndef ARDUINO
+  // The host tests replace the clock to simulate hours of playback in a moment.
+  inline uint32_t (*simulatedUsec)(){};
+#endif
+
+  // A free running microseconds clock; the timer of the board, or a monotonic
+  // clock on other platforms. It overflows after about 71 minutes.
+  inline uint32_t getUsec() {
+#ifdef ARDUINO
+    return V2Base::getUsec();
+#else
+    if (simulatedUsec)
+      return simulatedUsec();
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+  }
+
+  inline uint32_t getUsecSince(uint32_t usec) {
+    return (uint32_t)(getUsec() - usec);
+  }
+};
@@ -3,10 +3,38 @@
 
 #pragma once
 
+#include "Packet.h"
+#include <cstddef>
+
 namespace V2MIDI {
   class Transport {
   public:
     virtual bool receive(Packet* midi) = 0;
     virtual bool send(Packet* midi)    = 0;
+
+    // Receive up to 'max' packets with a single call, returns the number of
+    // received packets. Transports which can drain their buffers in one go
+    // should provide their own version. Subclasses which override only the
+    // single packet versions need 'using Transport::send' and 'using
+    // Transport::receive' to keep the batch calls visible.
+    virtual size_t receive(Packet* packets, size_t max) {
+      size_t n = 0;
+      while (n < max && receive(packets + n))
+        n++;
+
+      return n;
+    }
+
+    // Send up to 'count' packets with a single call, returns the number of
+    // sent packets. Sending stops at the first packet which is refused.
+    virtual size_t send(const Packet* packets, size_t count) {
+      for (size_t i = 0; i < count; i++) {
+        Packet packet = packets[i];
+        if (!send(&packet))
+          return i;
+      }
+
+      return count;
+    }
   };
 }
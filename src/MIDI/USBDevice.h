@@ -11,11 +11,30 @@ namespace V2MIDI {
   class USBDevice : public Transport, public V2Base::USBDevice {
   public:
     bool send(Packet* midi) {
-      return V2Base::USBDevice::send(midi->_data);
+      return V2Base::USBDevice::send(midi->getBytes());
     }
 
     bool receive(Packet* midi) {
-      return V2Base::USBDevice::receive(midi->_data);
+      return V2Base::USBDevice::receive(midi->getBytes());
+    }
+
+    // Drain the endpoint buffer without a virtual call for every packet.
+    size_t send(const Packet* packets, size_t count) {
+      for (size_t i = 0; i < count; i++) {
+        Packet packet = packets[i];
+        if (!V2Base::USBDevice::send(packet.getBytes()))
+          return i;
+      }
+
+      return count;
+    }
+
+    size_t receive(Packet* packets, size_t max) {
+      size_t n = 0;
+      while (n < max && V2Base::USBDevice::receive(packets[n].getBytes()))
+        n++;
+
+      return n;
     }
   };
 }
@@ -7,11 +7,18 @@
 #include "MIDI/CCHighResolution.h"
 #include "MIDI/Clock.h"
 #include "MIDI/File.h"
+#include "MIDI/Filter.h"
 #include "MIDI/GM.h"
 #include "MIDI/Notes.h"
 #include "MIDI/Packet.h"
 #include "MIDI/Port.h"
+#include "MIDI/Queue.h"
 #include "MIDI/RPN.h"
+#include "MIDI/Router.h"
+#include "MIDI/Scheduler.h"
 #include "MIDI/SerialDevice.h"
+#include "MIDI/SerialParser.h"
+#include "MIDI/SysEx.h"
+#include "MIDI/Time.h"
 #include "MIDI/Transport.h"
 #include "MIDI/USBDevice.h"
@@ -0,0 +1,506 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+// The playback of MIDI files with a simulated clock. Every event needs to be
+// sent at the first run() after its time on a reference timeline, over hours
+// of playback and tempo changes.
+
+#include "test.h"
+#include <MIDI/File.h>
+#include <vector>
+
+using namespace V2MIDI;
+
+namespace {
+  // The simulated time since the start of the test. The clock of the board
+  // starts close to its overflow.
+  uint64_t _clockUsec{};
+  uint64_t _clockLastUsec{};
+
+  uint32_t getSimulatedUsec() {
+    return (uint32_t)(UINT32_MAX - 5 * 1000 * 1000 + _clockUsec);
+  }
+
+  // Advance the simulated time.
+  void advance(uint32_t usec) {
+    _clockLastUsec = _clockUsec;
+    _clockUsec += usec;
+  }
+
+  // Writes a format 1 MIDI file.
+  class Builder {
+  public:
+    Builder(uint16_t nTracks, uint16_t division) : _tracks(nTracks) {
+      _data = {'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1};
+      _data.push_back(nTracks >> 8);
+      _data.push_back(nTracks);
+      _data.push_back(division >> 8);
+      _data.push_back(division);
+    }
+
+    void event(uint8_t track, uint32_t delta, std::initializer_list<uint8_t> bytes) {
+      writeNumber(_tracks[track], delta);
+      _tracks[track].insert(_tracks[track].end(), bytes);
+    }
+
+    void tempo(uint32_t delta, uint32_t usec) {
+      event(0, delta, {0xff, 0x51, 3, (uint8_t)(usec >> 16), (uint8_t)(usec >> 8), (uint8_t)usec});
+    }
+
+    const uint8_t* build() {
+      for (auto& track : _tracks) {
+        const uint8_t end[]{0, 0xff, 0x2f, 0};
+        track.insert(track.end(), end, end + sizeof(end));
+
+        const uint32_t length = track.size();
+        const uint8_t  header[]{'M', 'T', 'r', 'k', (uint8_t)(length >> 24), (uint8_t)(length >> 16), (uint8_t)(length >> 8), (uint8_t)length};
+        _data.insert(_data.end(), header, header + sizeof(header));
+        _data.insert(_data.end(), track.begin(), track.end());
+      }
+
+      return _data.data();
+    }
+
+  private:
+    std::vector<uint8_t>              _data;
+    std::vector<std::vector<uint8_t>> _tracks;
+
+    // Variable-length number, Big Endian, 7 bit data / byte.
+    static void writeNumber(std::vector<uint8_t>& data, uint32_t number) {
+      uint8_t bytes[5];
+      uint8_t n  = 0;
+      bytes[n++] = number & 0x7f;
+      while (number >>= 7)
+        bytes[n++] = 0x80 | (number & 0x7f);
+
+      while (n > 0)
+        data.push_back(bytes[--n]);
+    }
+  };
+
+  // Records the sent packets and the time of the run() which sent them.
+  class Player : public File::Tracks {
+  public:
+    struct Sent {
+      uint16_t track;
+      Packet   packet;
+      uint64_t usec;
+      uint64_t lastUsec;
+    };
+
+    // The default constructor of Tracks is ambiguous.
+    Player() : File::Tracks(NULL) {}
+
+    std::vector<Sent> sent;
+    State             state{};
+    bool              record{true};
+
+  private:
+    void handleStateChange(State s) {
+      state = s;
+    }
+
+    bool handleSend(uint16_t track, Packet* packet) {
+      if (record)
+        sent.push_back({track, *packet, _clockUsec, _clockLastUsec});
+
+      return true;
+    }
+  };
+
+  // The tempo segments of the test file, and its events at awkward distances
+  // which do not line up with the tempo changes.
+  constexpr uint16_t _division{480};
+  constexpr uint32_t _tempos[]{500000, 333333, 517241, 428571, 600001, 250007};
+  constexpr uint32_t _tempoTicks{64 * _division};
+  constexpr uint32_t _eventTicks{97};
+
+  // The time of a tick on the reference timeline, in units of 1 / division
+  // microseconds; the tempo segments are summed up from the start.
+  uint64_t getReferenceTime(uint32_t tick) {
+    uint64_t time = 0;
+    for (uint32_t segment = 0;; segment++) {
+      const uint32_t usec = _tempos[segment % std::size(_tempos)];
+      if (tick <= _tempoTicks) {
+        time += (uint64_t)tick * usec;
+        return time;
+      }
+
+      time += (uint64_t)_tempoTicks * usec;
+      tick -= _tempoTicks;
+    }
+  }
+
+  // The last tick at or before a time on the reference timeline.
+  uint32_t getReferenceTick(uint64_t time) {
+    uint32_t tick = 0;
+    for (uint32_t segment = 0;; segment++) {
+      const uint32_t usec = _tempos[segment % std::size(_tempos)];
+      if (time < (uint64_t)_tempoTicks * usec)
+        return tick + time / usec;
+
+      time -= (uint64_t)_tempoTicks * usec;
+      tick += _tempoTicks;
+    }
+  }
+
+  // A file of 'hours' duration, track 0 carries the tempo changes, track 1
+  // controller changes.
+  const uint8_t* buildFile(Builder& builder, uint32_t hours, uint32_t& ticks) {
+    ticks = 0;
+    while (getReferenceTime(ticks) / _division < (uint64_t)hours * 3600 * 1000 * 1000)
+      ticks += _tempoTicks;
+
+    for (uint32_t tick = 0; tick < ticks; tick += _tempoTicks)
+      builder.tempo(tick == 0 ? 0 : _tempoTicks, _tempos[(tick / _tempoTicks) % std::size(_tempos)]);
+
+    for (uint32_t tick = _eventTicks; tick < ticks; tick += _eventTicks)
+      builder.event(1, _eventTicks, {0xb0, 7, (uint8_t)(tick & 0x7f)});
+
+    return builder.build();
+  }
+
+  void testDrift() {
+    Builder        builder(2, _division);
+    uint32_t       ticks;
+    const uint8_t* data = buildFile(builder, 3, ticks);
+
+    Player player;
+    CHECK(player.load(data));
+    CHECK(player.getTicks() == (ticks - 1) / _eventTicks * _eventTicks);
+
+    _clockUsec = 0;
+    advance(0);
+    Time::simulatedUsec = getSimulatedUsec;
+    CHECK(player.play());
+
+    // Random intervals between the calls, the clock wraps around twice.
+    Test::Random random;
+    while (player.state == File::Tracks::State::Play) {
+      advance(50 + random.next() % 4000);
+      player.run();
+    }
+
+    Time::simulatedUsec = NULL;
+
+    // Every event is sent by the first run() at or after its time.
+    CHECK(player.sent.size() == (ticks - 1) / _eventTicks);
+    for (uint32_t i = 0; i < player.sent.size(); i++) {
+      const auto&    sent = player.sent[i];
+      const uint32_t tick = (i + 1) * _eventTicks;
+      const uint64_t time = getReferenceTime(tick);
+      CHECK(sent.track == 1);
+      CHECK(sent.packet.getControllerValue() == (tick & 0x7f));
+      CHECK(sent.lastUsec * _division < time);
+      CHECK(sent.usec * _division >= time);
+    }
+
+    CHECK(_clockUsec > 3ULL * 3600 * 1000 * 1000);
+  }
+
+  // The old clock; every run() added the passed time divided by the float
+  // duration of a tick.
+  class FloatClock {
+  public:
+    float tick{};
+    float tickDurationUsec{};
+
+    void setTempoUsec(uint32_t usec) {
+      tickDurationUsec = (float)usec / (float)_division;
+    }
+
+    void run(uint32_t passedUsec) {
+      tick += passedUsec / tickDurationUsec;
+    }
+  };
+
+  // The fixed-point clock of the player.
+  class FixedClock {
+  public:
+    uint64_t time{};
+    uint32_t tick{};
+    struct {
+      uint32_t tick;
+      uint64_t time;
+      uint32_t usec;
+    } tempo{};
+
+    void setTempoUsec(uint32_t usec) {
+      tempo = {tick, tempo.time + (uint64_t)(tick - tempo.tick) * tempo.usec, usec};
+    }
+
+    void run(uint32_t passedUsec) {
+      time += (uint64_t)passedUsec * _division;
+      tick = tempo.tick + (time - tempo.time) / tempo.usec;
+    }
+  };
+
+  // The error of the old float clock against the reference timeline after
+  // three hours of one millisecond steps.
+  void reportFloatDrift() {
+    FloatClock clock;
+    uint32_t   segment = 0;
+    clock.setTempoUsec(_tempos[0]);
+
+    const uint64_t steps = 3ULL * 3600 * 1000;
+    for (uint64_t i = 0; i < steps; i++) {
+      clock.run(1000);
+      if (clock.tick >= (float)(segment + 1) * _tempoTicks) {
+        segment++;
+        clock.setTempoUsec(_tempos[segment % std::size(_tempos)]);
+      }
+    }
+
+    const uint32_t tick = getReferenceTick(steps * 1000 * _division);
+    printf("%-48s %10.0f ticks\n", "Float clock error after 3 hours", (double)tick - clock.tick);
+  }
+
+  void benchmarkClock() {
+    constexpr uint32_t n = 10 * 1000 * 1000;
+
+    double floatSeconds = 0;
+    {
+      FloatClock clock;
+      clock.setTempoUsec(_tempos[1]);
+      floatSeconds = Test::measure(n, [&](uint32_t i) {
+        clock.run(*Test::opaque(&i) & 0x7ff);
+        Test::use(clock.tick);
+      });
+    }
+
+    double fixedSeconds = 0;
+    {
+      FixedClock clock;
+      clock.setTempoUsec(_tempos[1]);
+      fixedSeconds = Test::measure(n, [&](uint32_t i) {
+        clock.run(*Test::opaque(&i) & 0x7ff);
+        Test::use(clock.tick);
+      });
+    }
+
+    Test::report("Clock update, float", n, floatSeconds, "runs");
+    Test::report("Clock update, fixed point", n, fixedSeconds, "runs");
+    printf("%-48s %10.2f ns\n", "Clock update, float minus fixed point", (floatSeconds - fixedSeconds) / n * 1e9);
+  }
+
+  // The cost of a run() call, one millisecond after the last one.
+  void benchmarkRun() {
+    Builder        builder(2, _division);
+    uint32_t       ticks;
+    const uint8_t* data = buildFile(builder, 1, ticks);
+
+    Player player;
+    player.record = false;
+    CHECK(player.load(data));
+    player.setLoop(0, ticks);
+
+    _clockUsec          = 0;
+    Time::simulatedUsec = getSimulatedUsec;
+    CHECK(player.play());
+
+    constexpr uint32_t n       = 1000 * 1000;
+    const double       seconds = Test::measure(n, [&](uint32_t i) {
+      advance(1000);
+      player.run();
+    });
+
+    Time::simulatedUsec = NULL;
+    CHECK(player.state == File::Tracks::State::Play);
+    Test::report("File run(), every millisecond", n, seconds, "runs");
+    printf("%-48s %10.2f ns\n", "File run(), per call", seconds / n * 1e9);
+  }
+
+  // Sixteen tracks of notes and dense controller automation, written with
+  // Running Status.
+  const uint8_t* buildDenseFile(Builder& builder, uint32_t nEvents) {
+    Test::Random random;
+    builder.tempo(0, _tempos[0]);
+    for (uint8_t track = 0; track < 16; track++) {
+      uint8_t status = 0;
+      for (uint32_t i = 0; i < nEvents; i++) {
+        const uint32_t delta = random.next() % 4 == 0 ? random.next() % 24 : 0;
+        const uint8_t  type  = random.next() % 8 == 0 ? 0x90 : 0xb0;
+        const uint8_t  data1 = type == 0x90 ? 36 + random.next() % 48 : 1 + random.next() % 4;
+        const uint8_t  data2 = random.next() & 0x7f;
+        if (type + track == status) {
+          builder.event(track, delta, {data1, data2});
+          continue;
+        }
+
+        status = type + track;
+        builder.event(track, delta, {status, data1, data2});
+      }
+    }
+
+    return builder.build();
+  }
+
+  // Play the whole file with a single run().
+  void playAll(Player& player) {
+    player.sent.clear();
+    CHECK(player.play());
+    advance(player.getDurationUsec() + 1);
+    player.run();
+    CHECK(player.state == File::Tracks::State::Stop);
+  }
+
+  // The index sends the same packets in the same order as the live decoding
+  // of the tracks.
+  void testIndex() {
+    Builder        builder(16, _division);
+    const uint8_t* data = buildDenseFile(builder, 4096);
+
+    Time::simulatedUsec = getSimulatedUsec;
+
+    Player live;
+    CHECK(live.load(data));
+    playAll(live);
+    CHECK(live.sent.size() == 16 * 4096);
+
+    Player indexed;
+    CHECK(indexed.load(data));
+    std::vector<File::Tracks::Entry> entries(indexed.getIndexSize());
+    CHECK(entries.size() == 16 * 4096 + 1);
+    CHECK(!indexed.index(entries.data(), entries.size() - 1));
+    CHECK(indexed.index(entries.data(), entries.size()));
+    playAll(indexed);
+
+    CHECK(indexed.sent.size() == live.sent.size());
+    for (uint32_t i = 0; i < live.sent.size(); i++) {
+      CHECK(indexed.sent[i].track == live.sent[i].track);
+      CHECK(indexed.sent[i].packet.getWord() == live.sent[i].packet.getWord());
+    }
+
+    Time::simulatedUsec = NULL;
+  }
+
+  // Sleep until the next event instead of polling; every event is sent at the
+  // first microsecond of its time.
+  void testNextEvent() {
+    Builder        builder(2, _division);
+    uint32_t       ticks;
+    const uint8_t* data = buildFile(builder, 1, ticks);
+
+    Player player;
+    CHECK(player.load(data));
+
+    uint32_t usec;
+    CHECK(!player.getNextEventUsec(usec));
+
+    _clockUsec          = 0;
+    Time::simulatedUsec = getSimulatedUsec;
+    CHECK(player.play());
+
+    uint32_t nWakeups = 0;
+    while (player.getNextEventUsec(usec)) {
+      CHECK(usec > 0 || nWakeups == 0);
+      advance(usec);
+      player.run();
+      nWakeups++;
+    }
+
+    Time::simulatedUsec = NULL;
+    CHECK(player.state == File::Tracks::State::Stop);
+
+    // One wakeup for every event and tempo change.
+    CHECK(player.sent.size() == (ticks - 1) / _eventTicks);
+    CHECK(nWakeups <= player.sent.size() + ticks / _tempoTicks + 1);
+    for (uint32_t i = 0; i < player.sent.size(); i++) {
+      const auto&    sent = player.sent[i];
+      const uint64_t time = getReferenceTime((i + 1) * _eventTicks);
+      CHECK(sent.usec * _division >= time);
+      CHECK((sent.usec - 1) * _division < time);
+    }
+  }
+
+  // A seek releases every sounding note to the track which played it, and sends
+  // the bank select, program and controllers again.
+  void testSeek() {
+    Builder builder(3, _division);
+    builder.event(0, 960, {0xff, 0x06, 1, 'B'});
+    builder.event(1, 0, {0xb0, 0, 1});
+    builder.event(1, 0, {0xb0, 32, 2});
+    builder.event(1, 0, {0xc0, 5});
+    builder.event(1, 0, {0xb0, 7, 100});
+    builder.event(1, 100, {0x90, 60, 100});
+    builder.event(1, 1900, {0x80, 60, 0});
+    builder.event(2, 200, {0x90, 62, 90});
+    builder.event(2, 100, {0xc1, 7});
+    const uint8_t* data = builder.build();
+
+    Player player;
+    CHECK(player.load(data));
+
+    _clockUsec          = 0;
+    Time::simulatedUsec = getSimulatedUsec;
+    CHECK(player.play());
+    advance(player.tickToUsec(500));
+    player.run();
+    CHECK(player.sent.size() == 7);
+
+    player.sent.clear();
+    CHECK(player.seek("B"));
+    Time::simulatedUsec = NULL;
+
+    const struct {
+      uint16_t track;
+      uint32_t word;
+    } expected[]{
+      {1, Packet().setNoteOff(0, 60, 64)->getWord()},
+      {2, Packet().setNoteOff(0, 62, 64)->getWord()},
+      {1, Packet().setControlChange(0, CC::BankSelect, 1)->getWord()},
+      {1, Packet().setControlChange(0, CC::BankSelectLSB, 2)->getWord()},
+      {1, Packet().setProgram(0, 5)->getWord()},
+      {1, Packet().setControlChange(0, CC::ChannelVolume, 100)->getWord()},
+      {2, Packet().setProgram(1, 7)->getWord()},
+    };
+
+    CHECK(player.sent.size() == std::size(expected));
+    for (uint32_t i = 0; i < player.sent.size(); i++) {
+      CHECK(player.sent[i].track == expected[i].track);
+      CHECK(player.sent[i].packet.getWord() == expected[i].word);
+    }
+  }
+
+  // The events per second of the live decoding and the index.
+  void benchmarkIndex() {
+    Builder        builder(16, _division);
+    const uint8_t* data = buildDenseFile(builder, 16 * 1024);
+
+    Time::simulatedUsec = getSimulatedUsec;
+
+    Player live;
+    live.record = false;
+    CHECK(live.load(data));
+    const double liveSeconds = Test::measure(1, [&](uint32_t i) { playAll(live); });
+
+    Player indexed;
+    indexed.record = false;
+    CHECK(indexed.load(data));
+    std::vector<File::Tracks::Entry> entries(indexed.getIndexSize());
+    CHECK(indexed.index(entries.data(), entries.size()));
+    const double indexSeconds = Test::measure(1, [&](uint32_t i) { playAll(indexed); });
+
+    Time::simulatedUsec = NULL;
+    Test::report("File playback, 16 tracks, live decoding", entries.size(), liveSeconds, "events");
+    Test::report("File playback, 16 tracks, index", entries.size(), indexSeconds, "events");
+
+#ifdef NDEBUG
+    // Reading the prepared packets is about three times faster than decoding
+    // the tracks.
+    CHECK(liveSeconds / indexSeconds >= 2);
+#endif
+  }
+};
+
+int main() {
+  testDrift();
+  testIndex();
+  testNextEvent();
+  testSeek();
+  reportFloatDrift();
+  benchmarkClock();
+  benchmarkRun();
+  benchmarkIndex();
+  return EXIT_SUCCESS;
+}
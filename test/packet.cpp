@@ -0,0 +1,160 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+// The table lookup of Packet::set() compared with the previous switch.
+
+#include "test.h"
+#include <MIDI/Packet.h>
+
+using namespace V2MIDI;
+
+namespace {
+  // The previous set(), the code index is selected with a switch, the system
+  // messages check the channel in every case.
+  bool setSwitch(uint8_t data[4], uint8_t channel, Packet::Status type, uint8_t data1, uint8_t data2) {
+    using Status    = Packet::Status;
+    using CodeIndex = Packet::CodeIndex;
+    uint8_t index;
+
+    switch (type) {
+      case Status::NoteOff:
+        index = static_cast<uint8_t>(CodeIndex::NoteOff);
+        break;
+
+      case Status::NoteOn:
+        index = static_cast<uint8_t>(CodeIndex::NoteOn);
+        break;
+
+      case Status::Aftertouch:
+        index = static_cast<uint8_t>(CodeIndex::Aftertouch);
+        break;
+
+      case Status::ControlChange:
+        index = static_cast<uint8_t>(CodeIndex::ControlChange);
+        break;
+
+      case Status::ProgramChange:
+        index = static_cast<uint8_t>(CodeIndex::ProgramChange);
+        break;
+
+      case Status::AftertouchChannel:
+        index = static_cast<uint8_t>(CodeIndex::AftertouchChannel);
+        break;
+
+      case Status::PitchBend:
+        index = static_cast<uint8_t>(CodeIndex::PitchBend);
+        break;
+
+      case Status::SystemSongSelect:
+      case Status::SystemTimeCodeQuarterFrame:
+        if (channel > 0)
+          return false;
+        index = static_cast<uint8_t>(CodeIndex::SystemCommon2);
+        break;
+
+      case Status::SystemSongPosition:
+        if (channel > 0)
+          return false;
+        index = static_cast<uint8_t>(CodeIndex::SystemCommon3);
+        break;
+
+      case Status::SystemTuneRequest:
+      case Status::SystemClock:
+      case Status::SystemStart:
+      case Status::SystemContinue:
+      case Status::SystemStop:
+      case Status::SystemActiveSensing:
+      case Status::SystemReset:
+        if (channel > 0)
+          return false;
+        index = static_cast<uint8_t>(CodeIndex::SingleByte);
+        break;
+
+      default:
+        return false;
+    }
+
+    data[0] = (data[0] & 0xf0) | index;
+    data[1] = static_cast<uint8_t>(type) | channel;
+    data[2] = data1;
+    data[3] = data2;
+    return true;
+  }
+
+  // Every type and channel, the virtual port is preserved.
+  void testEquivalence() {
+    uint32_t valid = 0;
+    for (uint32_t t = 0; t < 256; t++) {
+      for (uint8_t channel = 0; channel < 16; channel++) {
+        const auto type     = static_cast<Packet::Status>(t);
+        uint8_t    data[4]  = {0x50, 0, 0, 0};
+        const bool expected = setSwitch(data, channel, type, 0x12, 0x34);
+
+        Packet packet(0x50);
+        CHECK((packet.set(channel, type, 0x12, 0x34) != NULL) == expected);
+        if (!expected) {
+          CHECK(packet.getWord() == 0x50);
+          continue;
+        }
+
+        valid++;
+        for (uint8_t i = 0; i < 4; i++)
+          CHECK(packet.getByte(i) == data[i]);
+      }
+    }
+
+    // 7 channel message types on 16 channels, 10 system messages.
+    CHECK(valid == 7 * 16 + 10);
+  }
+
+  void benchmark() {
+    constexpr uint32_t n = 100000;
+    Packet             packets[256];
+    uint8_t            data[256][4];
+
+    // An arpeggio with a controller after every note.
+    const double switchSeconds = Test::measure(n, [&](uint32_t i) {
+      for (uint32_t p = 0; p < 256; p += 2) {
+        setSwitch(data[p], p & 0x0f, Packet::Status::NoteOn, (i + p) & 0x7f, 100);
+        setSwitch(data[p + 1], p & 0x0f, Packet::Status::ControlChange, 1, (i + p) & 0x7f);
+      }
+      Test::use(data);
+    });
+    Test::report("switch, note and control change", n * 256.0, switchSeconds, "packets");
+
+    const double tableSeconds = Test::measure(n, [&](uint32_t i) {
+      for (uint32_t p = 0; p < 256; p += 2) {
+        packets[p].setNote(p & 0x0f, (i + p) & 0x7f, 100);
+        packets[p + 1].setControlChange(p & 0x0f, 1, (i + p) & 0x7f);
+      }
+      Test::use(packets);
+    });
+    Test::report("table, setNote() and setControlChange()", n * 256.0, tableSeconds, "packets");
+
+    // The type is not known at compile time.
+    Packet::Status types[256];
+    for (uint32_t p = 0; p < 256; p++)
+      types[p] = p & 1 ? Packet::Status::ControlChange : Packet::Status::NoteOn;
+    Test::use(types);
+
+    const double switchTypeSeconds = Test::measure(n, [&](uint32_t i) {
+      for (uint32_t p = 0; p < 256; p++)
+        setSwitch(data[p], p & 0x0f, types[p], (i + p) & 0x7f, 100);
+      Test::use(data);
+    });
+    Test::report("switch, runtime type", n * 256.0, switchTypeSeconds, "packets");
+
+    const double tableTypeSeconds = Test::measure(n, [&](uint32_t i) {
+      for (uint32_t p = 0; p < 256; p++)
+        packets[p].set(p & 0x0f, types[p], (i + p) & 0x7f, 100);
+      Test::use(packets);
+    });
+    Test::report("table, runtime type", n * 256.0, tableTypeSeconds, "packets");
+  }
+};
+
+int main() {
+  testEquivalence();
+  benchmark();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,336 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+// The table dispatch of Port compared with the previous switch dispatch, which
+// called handlePacket() and a typed handler for every message.
+//
+// The stream is larger than the history of a host's branch predictor, a short
+// repeated stream is learned and measures the predictor instead of the dispatch.
+// The numbers are relative; the table replaces the compare chains of the switches,
+// which matter most on the Cortex-M cores without a branch predictor.
+
+#include "test.h"
+#include <MIDI/Port.h>
+#include <algorithm>
+
+using namespace V2MIDI;
+
+// Outside of the anonymous namespace, like Port the virtual handlers cannot be
+// resolved at compile time.
+namespace Reference {
+  // The previous dispatch: the SysEx state switch, the switch on the message type
+  // with the counters, handlePacket() and the typed virtual for every message.
+  class SwitchPort {
+  public:
+    virtual ~SwitchPort() = default;
+
+    void dispatch(Transport* transport, Packet* packet) {
+      _input.packet++;
+
+      switch (packet->getCodeIndex()) {
+        case Packet::CodeIndex::SingleByte:
+          if (_sysex.appending)
+            return;
+          break;
+
+        case Packet::CodeIndex::SystemExclusiveStart:
+          _sysex.appending = true;
+          return;
+
+        default:
+          _sysex.appending = false;
+          _sysex.length    = 0;
+          break;
+      }
+
+      if (packet->getType() != Packet::Status::SystemExclusive)
+        handlePacket(packet);
+
+      switch (packet->getType()) {
+        case Packet::Status::NoteOn:
+          _input.note++;
+          handleNote(packet->getChannel(), packet->getNote(), packet->getNoteVelocity());
+          break;
+
+        case Packet::Status::NoteOff:
+          _input.noteOff++;
+          handleNoteOff(packet->getChannel(), packet->getNote(), packet->getNoteVelocity());
+          break;
+
+        case Packet::Status::ControlChange:
+          _input.control++;
+          handleControlChange(packet->getChannel(), packet->getController(), packet->getControllerValue());
+          break;
+
+        case Packet::Status::PitchBend:
+          _input.pitchbend++;
+          handlePitchBend(packet->getChannel(), packet->getPitchBend());
+          break;
+
+        case Packet::Status::SystemClock:
+          _input.system.clock.tick++;
+          handleClock(Clock::Event::Tick);
+          break;
+
+        case Packet::Status::SystemStart:
+          handleClock(Clock::Event::Start);
+          break;
+
+        case Packet::Status::SystemStop:
+          handleClock(Clock::Event::Stop);
+          break;
+      }
+    }
+
+    virtual void handlePacket(Packet* packet) {}
+    virtual void handleNote(uint8_t channel, uint8_t note, uint8_t velocity) {}
+    virtual void handleNoteOff(uint8_t channel, uint8_t note, uint8_t velocity) {}
+    virtual void handleControlChange(uint8_t channel, uint8_t controller, uint8_t value) {}
+    virtual void handlePitchBend(uint8_t channel, int16_t value) {}
+    virtual void handleClock(Clock::Event clock) {}
+
+    Port::Counter _input{};
+
+  private:
+    struct {
+      bool     appending;
+      uint32_t length;
+    } _sysex{};
+  };
+};
+
+namespace {
+  // Sum up the arguments of all handler calls.
+  struct Result {
+    uint32_t note{};
+    uint32_t control{};
+    uint32_t clock{};
+    uint32_t packet{};
+
+    bool operator==(const Result& other) const {
+      return note == other.note && control == other.control && clock == other.clock && packet == other.packet;
+    }
+  };
+
+  class TablePort : public Port {
+  public:
+    constexpr TablePort() : Port(0, 0) {}
+
+    const Counter& getInput() const {
+      return _statistics.input;
+    }
+
+    Result result;
+
+  private:
+    void handleNote(uint8_t channel, uint8_t note, uint8_t velocity) {
+      result.note += channel + note + velocity;
+    }
+
+    void handleControlChange(uint8_t channel, uint8_t controller, uint8_t value) {
+      result.control += channel + controller + value;
+    }
+
+    void handleClock(Clock::Event clock) {
+      result.clock += static_cast<uint8_t>(clock) + 1;
+    }
+  };
+
+  // Only the handlers, the table dispatch skips handlePacket() and the counters of
+  // the unhandled messages.
+  class TypedPort : public BasicPort<TypedPort> {
+  public:
+    constexpr TypedPort() : BasicPort(0, 0) {}
+
+    Result result;
+
+  private:
+    friend class BasicPort<TypedPort>;
+
+    void handleNote(uint8_t channel, uint8_t note, uint8_t velocity) {
+      result.note += channel + note + velocity;
+    }
+
+    void handleControlChange(uint8_t channel, uint8_t controller, uint8_t value) {
+      result.control += channel + controller + value;
+    }
+
+    void handleClock(Clock::Event clock) {
+      result.clock += static_cast<uint8_t>(clock) + 1;
+    }
+  };
+
+  class SwitchPort : public Reference::SwitchPort {
+  public:
+    Result result;
+
+  private:
+    void handleNote(uint8_t channel, uint8_t note, uint8_t velocity) {
+      result.note += channel + note + velocity;
+    }
+
+    void handleControlChange(uint8_t channel, uint8_t controller, uint8_t value) {
+      result.control += channel + controller + value;
+    }
+
+    void handleClock(Clock::Event clock) {
+      result.clock += static_cast<uint8_t>(clock) + 1;
+    }
+  };
+
+  // Counts the packets, a port with a packet handler sees every message.
+  class PacketPort : public TablePort {
+  public:
+    void handlePacket(Packet* packet) {
+      result.packet++;
+    }
+  };
+
+  // Counts the received SysEx messages.
+  class ExclusivePort : public BasicPort<ExclusivePort> {
+  public:
+    ExclusivePort() : BasicPort(0, 64) {}
+
+    uint32_t getPackets() const {
+      return _statistics.input.packet;
+    }
+
+    uint32_t messages{};
+
+  private:
+    friend class BasicPort<ExclusivePort>;
+
+    void handleSystemExclusive(const uint8_t* buffer, uint32_t len) {
+      messages++;
+    }
+  };
+
+  // The batched dispatch copies the payload of a running SysEx message without
+  // looking at the packets; a filter which drops SysEx needs to see them. Dropped
+  // packets are not counted.
+  void testFilter() {
+    uint8_t message[30]{0xf0};
+    message[29] = 0xf7;
+    Packet packets[10];
+    SysEx::packetize(message, sizeof(message), 0, 0, packets, 10);
+
+    Filter drop;
+    drop.setType(Packet::Status::SystemExclusive, false);
+    Filter remap;
+    remap.mapChannel(0, 1);
+
+    for (const Filter* filter : {(const Filter*)NULL, (const Filter*)&remap, (const Filter*)&drop}) {
+      ExclusivePort port;
+      port.begin();
+
+      // The filter is set after the start of the message.
+      Packet copy[10];
+      std::copy(packets, packets + 10, copy);
+      port.dispatch(NULL, copy, 1);
+      port.setFilter(filter);
+      port.dispatch(NULL, copy + 1, 9);
+      CHECK(port.messages == (filter == &drop ? 0 : 1));
+      CHECK(port.getPackets() == (filter == &drop ? 1 : 10));
+    }
+  }
+
+  // Notes, controllers and clock ticks, like a played keyboard synced to a sequencer.
+  void fill(Packet* packets, uint32_t count) {
+    Test::Random random;
+    for (uint32_t i = 0; i < count; i++) {
+      const uint32_t r = random.next();
+      switch (r % 8) {
+        case 0:
+        case 1:
+        case 2:
+          packets[i].setNote(r >> 8 & 0x0f, r >> 12 & 0x7f, r >> 20 & 0x7f);
+          break;
+
+        case 3:
+        case 4:
+          packets[i].setControlChange(r >> 8 & 0x0f, r >> 12 & 0x7f, r >> 20 & 0x7f);
+          break;
+
+        case 5:
+          packets[i].setPitchBend(r >> 8 & 0x0f, (r >> 12 & 0x3fff) - 8192);
+          break;
+
+        default:
+          packets[i].set(0, Packet::Status::SystemClock);
+          break;
+      }
+    }
+  }
+
+  constexpr uint32_t _count{1 << 20};
+  Packet             _packets[_count];
+
+  void testEquivalence() {
+    TablePort  table;
+    TypedPort  typed;
+    SwitchPort reference;
+    PacketPort all;
+    for (uint32_t i = 0; i < _count; i++) {
+      Packet packet = _packets[i];
+      table.dispatch(NULL, &packet);
+      packet = _packets[i];
+      typed.dispatch(NULL, &packet);
+      packet = _packets[i];
+      reference.dispatch(NULL, &packet);
+      packet = _packets[i];
+      all.dispatch(NULL, &packet);
+    }
+
+    CHECK(table.result == reference.result);
+    CHECK(typed.result == reference.result);
+    CHECK(all.result.packet == _count);
+
+    // Port declares all handlers, its counters match.
+    const Port::Counter& input = table.getInput();
+    CHECK(input.packet == reference._input.packet);
+    CHECK(input.note == reference._input.note);
+    CHECK(input.control == reference._input.control);
+    CHECK(input.system.clock.tick == reference._input.system.clock.tick);
+    CHECK(input.pitchbend == reference._input.pitchbend);
+  }
+
+  void benchmark() {
+    constexpr uint32_t     n = 10;
+    SwitchPort             reference;
+    TablePort              table;
+    TypedPort              typed;
+    Reference::SwitchPort* referencePointer = Test::opaque(&reference);
+    Port*                  tablePointer     = Test::opaque(static_cast<Port*>(&table));
+    TypedPort*             typedPointer     = Test::opaque(&typed);
+
+    const double switchSeconds = Test::measure(n, [&](uint32_t) {
+      for (uint32_t i = 0; i < _count; i++)
+        referencePointer->dispatch(NULL, _packets + i);
+    });
+    Test::report("switch dispatch", (double)n * _count, switchSeconds, "packets");
+
+    const double tableSeconds = Test::measure(n, [&](uint32_t) {
+      for (uint32_t i = 0; i < _count; i++)
+        tablePointer->dispatch(NULL, _packets + i);
+    });
+    Test::report("table dispatch, Port", (double)n * _count, tableSeconds, "packets");
+
+    const double typedSeconds = Test::measure(n, [&](uint32_t) {
+      for (uint32_t i = 0; i < _count; i++)
+        typedPointer->dispatch(NULL, _packets + i);
+    });
+    Test::report("table dispatch, BasicPort", (double)n * _count, typedSeconds, "packets");
+
+    Test::use(reference.result);
+    Test::use(table.result);
+    Test::use(typed.result);
+  }
+};
+
+int main() {
+  fill(_packets, _count);
+  testEquivalence();
+  testFilter();
+  benchmark();
+  return EXIT_SUCCESS;
+}
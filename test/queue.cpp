@@ -0,0 +1,148 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+// Producer and consumer in two threads, in place of an interrupt handler and
+// the main loop. Also built with -fsanitize=thread as 'queue-tsan'.
+
+#include "test.h"
+#include <MIDI/Queue.h>
+#include <atomic>
+#include <thread>
+
+using namespace V2MIDI;
+
+namespace {
+  constexpr uint32_t _count{200000};
+
+  void testQueue() {
+    Queue<64> queue;
+    uint32_t  refused = 0;
+
+    std::thread producer([&] {
+      for (uint32_t i = 1; i <= _count;) {
+        Packet packet(i);
+        if (queue.push(&packet)) {
+          i++;
+          continue;
+        }
+
+        refused++;
+        std::this_thread::yield();
+      }
+    });
+
+    // Alternate the single and batched pops, the sequence has no gaps.
+    uint32_t expected = 1;
+    while (expected <= _count) {
+      Packet packets[16];
+      size_t n;
+      if (expected & 1)
+        n = queue.pop(packets) ? 1 : 0;
+      else
+        n = queue.pop(packets, 16);
+
+      for (size_t i = 0; i < n; i++)
+        CHECK(packets[i].getWord() == expected++);
+
+      if (n == 0)
+        std::this_thread::yield();
+    }
+
+    producer.join();
+
+    Packet packet;
+    CHECK(!queue.pop(&packet));
+    CHECK(queue.getCount() == 0);
+    CHECK(queue.getStatistics().packet == _count);
+    CHECK(queue.getStatistics().overflow == refused);
+    printf("Queue: %u packets, %u refused\n", _count, refused);
+  }
+
+  // The wrapped transport counts the packets in both directions.
+  class Device : public Transport {
+  public:
+    using Transport::receive;
+    using Transport::send;
+
+    bool receive(Packet* packet) {
+      if (_received == _count)
+        return false;
+
+      packet->setWord(++_received);
+      return true;
+    }
+
+    // Refuse every fourth packet, like a full endpoint buffer.
+    bool send(Packet* packet) {
+      if (++_calls % 4 == 0)
+        return false;
+
+      CHECK(packet->getWord() == ++_sent);
+      return true;
+    }
+
+    uint32_t getSent() const {
+      return _sent;
+    }
+
+  private:
+    uint32_t _received{};
+    uint32_t _sent{};
+    uint32_t _calls{};
+  };
+
+  void testQueuedTransport() {
+    Device              device;
+    QueuedTransport<64> queued(&device);
+    std::atomic<bool>   done{};
+
+    // The interrupt handler.
+    std::thread interrupt([&] {
+      while (!done.load()) {
+        queued.pollReceive();
+        queued.pollSend();
+        std::this_thread::yield();
+      }
+    });
+
+    // The main loop echoes every received packet.
+    uint32_t received = 0;
+    uint32_t sent     = 0;
+    uint32_t refused  = 0;
+    while (sent < _count) {
+      Packet packets[16];
+      for (size_t i = 0, n = queued.receive(packets, 16); i < n; i++)
+        CHECK(packets[i].getWord() == ++received);
+
+      while (sent < received) {
+        Packet packet(sent + 1);
+        if (!queued.send(&packet)) {
+          refused++;
+          break;
+        }
+
+        sent++;
+      }
+
+      std::this_thread::yield();
+    }
+
+    while (queued.getOutput().getCount() > 0)
+      std::this_thread::yield();
+
+    done.store(true);
+    interrupt.join();
+    queued.pollSend();
+
+    CHECK(received == _count);
+    CHECK(device.getSent() == _count);
+    CHECK(queued.getOutput().getStatistics().overflow == refused);
+    printf("QueuedTransport: %u packets, %u refused\n", _count, refused);
+  }
+};
+
+int main() {
+  testQueue();
+  testQueuedTransport();
+  return EXIT_SUCCESS;
+}
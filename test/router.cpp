@@ -0,0 +1,128 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+// The routing of the message classes, and the forwarding of 16 ports to 16
+// outputs.
+
+#include "test.h"
+#include <MIDI/Router.h>
+
+using namespace V2MIDI;
+
+namespace {
+  // Counts the packets and remembers the last one.
+  class Output : public Transport {
+  public:
+    using Transport::receive;
+    using Transport::send;
+
+    bool receive(Packet* packet) {
+      return false;
+    }
+
+    bool send(Packet* packet) {
+      last = *packet;
+      count++;
+      return true;
+    }
+
+    Packet   last;
+    uint32_t count{};
+  };
+
+  constexpr uint8_t classBit(Router::Class type) {
+    return 1 << static_cast<uint8_t>(type);
+  }
+
+  // Port 1 sends notes of channel 3 to output 0, real-time messages to output 1,
+  // system messages to output 2 and SysEx to output 3.
+  constexpr Router::Matrix _matrix = [] {
+    Router::Matrix matrix;
+    matrix.connect(1, 1 << 3, classBit(Router::Class::Note), 1 << 0);
+    matrix.connect(1, 0, classBit(Router::Class::RealTime), 1 << 1);
+    matrix.connect(1, 0, classBit(Router::Class::System), 1 << 2);
+    matrix.connect(1, 0, classBit(Router::Class::Exclusive), 1 << 3);
+    return matrix;
+  }();
+
+  static_assert(_matrix.get(1, 3, Router::Class::Note) == 1);
+  static_assert(_matrix.get(1, 4, Router::Class::Note) == 0);
+
+  void testClasses() {
+    Output outputs[4];
+    Router router(&_matrix);
+    for (uint8_t i = 0; i < 4; i++)
+      CHECK(router.setOutput(i, outputs + i, 7));
+
+    auto forward = [&](Packet packet) {
+      packet.setPort(1);
+      return router.forward(&packet);
+    };
+
+    Packet packet;
+    CHECK(forward(*packet.setNote(3, 60, 100)) == 1);
+    CHECK(outputs[0].count == 1);
+    CHECK(outputs[0].last.getPort() == 7);
+    CHECK(forward(*packet.setNote(4, 60, 100)) == 0);
+    CHECK(router.statistics.unrouted == 1);
+
+    // The status byte selects the class of a single byte packet.
+    CHECK(forward(*packet.set(0, Packet::Status::SystemClock)) == 1);
+    CHECK(forward(*packet.set(0, Packet::Status::SystemReset)) == 1);
+    CHECK(outputs[1].count == 2);
+
+    CHECK(forward(*packet.set(0, Packet::Status::SystemTuneRequest)) == 1);
+    CHECK(forward(*packet.set(0, Packet::Status::SystemSongPosition, 1, 2)) == 1);
+    CHECK(outputs[2].count == 2);
+
+    // A data byte in the middle of a SysEx message.
+    CHECK(forward(Packet(0x0000420f)) == 1);
+    CHECK(forward(Packet(0x017df004)) == 1);
+    CHECK(outputs[3].count == 2);
+    CHECK(outputs[1].count == 2);
+  }
+
+  // Every port and channel to every output.
+  void benchmark() {
+    Router::Matrix matrix;
+    for (uint8_t port = 0; port < 16; port++)
+      matrix.connect(port, 0xffff, 0xff, 0xffff);
+
+    Output outputs[16];
+    Router router(&matrix);
+    for (uint8_t i = 0; i < 16; i++)
+      router.setOutput(i, outputs + i);
+
+    Packet       packets[256];
+    Test::Random random;
+    for (uint32_t i = 0; i < 256; i++) {
+      const uint32_t r = random.next();
+      if (r % 8 == 0)
+        packets[i].set(0, Packet::Status::SystemClock);
+      else
+        packets[i].setNote(r >> 8 & 0x0f, r >> 12 & 0x7f, 100);
+
+      packets[i].setPort(r >> 20 & 0x0f);
+    }
+
+    constexpr uint32_t n       = 10000;
+    const double       seconds = Test::measure(n, [&](uint32_t) {
+      for (const Packet& packet : packets)
+        Test::use(router.forward(&packet));
+    });
+    Test::report("forward, 16 ports to 16 outputs", n * 256.0, seconds, "packets");
+    Test::report("", n * 256.0 * 16, seconds, "deliveries");
+
+    uint32_t delivered = 0;
+    for (const Output& output : outputs)
+      delivered += output.count;
+    CHECK(delivered == 5 * n * 256 * 16);
+    CHECK(router.statistics.dropped == 0);
+  }
+};
+
+int main() {
+  testClasses();
+  benchmark();
+  return EXIT_SUCCESS;
+}
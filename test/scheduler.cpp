@@ -0,0 +1,156 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+// The clock jitter while a 64 KB SysEx message is streamed over the same
+// transport. The transport accepts 16 packets per frame, like a USB full-speed
+// endpoint; the clock ticks are sent at random points in a frame.
+
+#include "test.h"
+#include <MIDI/Port.h>
+#include <MIDI/Scheduler.h>
+
+using namespace V2MIDI;
+
+namespace {
+  // A port which receives the SysEx message.
+  class Receiver : public BasicPort<Receiver> {
+  public:
+    Receiver() : BasicPort(0, 65536) {}
+
+    uint32_t length{};
+    uint32_t messages{};
+    uint32_t mismatch{};
+
+  private:
+    friend class BasicPort<Receiver>;
+
+    void handleSystemExclusive(const uint8_t* buffer, uint32_t len) {
+      messages++;
+      length = len;
+      for (uint32_t i = 1; i + 1 < len; i++)
+        if (buffer[i] != ((i * 7) & 0x7f))
+          mismatch++;
+    }
+  };
+
+  // A port without handlers, only used to send the clock.
+  class ClockPort : public BasicPort<ClockPort> {
+  public:
+    ClockPort() : BasicPort(1, 0) {}
+  };
+
+  class Frames : public Transport {
+  public:
+    using Transport::receive;
+    using Transport::send;
+
+    bool receive(Packet* packet) {
+      return false;
+    }
+
+    bool send(Packet* packet) {
+      if (_sent == 16)
+        return false;
+
+      if (packet->getPort() == 1) {
+        // The position of the tick in the frame and the frames it was delayed.
+        CHECK(packet->getType() == Packet::Status::SystemClock);
+        if (_sent > maxPosition)
+          maxPosition = _sent;
+
+        const uint32_t delay = frame - ticks[nTicks++];
+        if (delay > maxDelay)
+          maxDelay = delay;
+
+      } else {
+        receiver->dispatch(this, packet);
+        sysex++;
+      }
+
+      _sent++;
+      return true;
+    }
+
+    void next() {
+      frame++;
+      _sent = 0;
+    }
+
+    Receiver* receiver;
+    uint32_t  frame{};
+    uint32_t  ticks[4096]{};
+    uint32_t  nTicks{};
+    uint32_t  maxDelay{};
+    uint32_t  maxPosition{};
+    uint32_t  sysex{};
+
+  private:
+    uint8_t _sent{};
+  };
+};
+
+int main() {
+  Receiver receiver;
+  receiver.begin();
+
+  Port sender(0, 65536);
+  sender.begin();
+
+  ClockPort clock;
+  clock.begin();
+
+  Frames transport;
+  transport.receiver = &receiver;
+
+  Scheduler scheduler(&transport);
+  CHECK(scheduler.add(&sender));
+  CHECK(scheduler.add(&clock));
+
+  constexpr uint32_t length = 65536;
+  uint8_t*           buffer = sender.getSystemExclusiveBuffer();
+  buffer[0]                 = static_cast<uint8_t>(Packet::Status::SystemExclusive);
+  for (uint32_t i = 1; i < length - 1; i++)
+    buffer[i] = (i * 7) & 0x7f;
+  buffer[length - 1] = static_cast<uint8_t>(Packet::Status::SystemExclusiveEnd);
+  CHECK(scheduler.sendSystemExclusive(&sender, length));
+
+  // A tick every 4 frames, before or after the frame's SysEx packets.
+  Test::Random random;
+  uint32_t     sent = 0;
+  for (bool pending = true; pending; transport.next()) {
+    const bool tick  = transport.frame % 4 == 0;
+    const bool early = random.next() & 1;
+    Packet     packet;
+
+    if (tick && early) {
+      transport.ticks[sent++] = transport.frame;
+      CHECK(scheduler.sendRealTime(&clock, packet.set(0, Packet::Status::SystemClock)));
+    }
+
+    pending = scheduler.loop();
+
+    if (tick && !early) {
+      transport.ticks[sent++] = transport.frame;
+      CHECK(scheduler.sendRealTime(&clock, packet.set(0, Packet::Status::SystemClock)));
+    }
+
+    CHECK(transport.frame < 10000);
+  }
+
+  // Flush a tick queued in the last frame.
+  scheduler.loop();
+
+  // The message arrived intact, interleaved with all ticks.
+  CHECK(receiver.messages == 1);
+  CHECK(receiver.length == length);
+  CHECK(receiver.mismatch == 0);
+  CHECK(transport.nTicks == sent);
+
+  // A tick waits at most for the next frame, and is its first packet.
+  CHECK(transport.maxDelay <= 1);
+  CHECK(transport.maxPosition == 0);
+
+  printf("SysEx %u bytes, %u packets in %u frames\n", length, transport.sysex, transport.frame);
+  printf("Clock %u ticks, jitter max %u frame(s)\n", sent, transport.maxDelay);
+  return EXIT_SUCCESS;
+}
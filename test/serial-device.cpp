@@ -0,0 +1,217 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+// The serial path without hardware: packets sent through a SerialDevice over an
+// in-memory loopback and over pipes, the throughput and the round-trip latency.
+
+#include "test.h"
+#include <MIDI/SerialDevice.h>
+#include <algorithm>
+#include <poll.h>
+#include <thread>
+#include <vector>
+
+using namespace V2MIDI;
+
+namespace {
+  // Notes and controllers on a few channels, clock ticks and a SysEx message.
+  std::vector<Packet> traffic(uint32_t count) {
+    std::vector<Packet> packets;
+    Test::Random        random(9);
+    while (packets.size() < count) {
+      const uint32_t r = random.next();
+      Packet         packet;
+      switch (r % 16) {
+        case 0:
+          packet.set(0, Packet::Status::SystemClock);
+          break;
+
+        case 1:
+          packets.emplace_back(0x017df004);
+          packet.setWord(0xf7030207);
+          break;
+
+        case 2:
+        case 3:
+        case 4:
+          packet.setControlChange(r >> 8 & 0x01, r >> 12 & 0x7f, r >> 20 & 0x7f);
+          break;
+
+        default:
+          packet.setNote(r >> 8 & 0x01, r >> 12 & 0x7f, 1 + (r >> 20 & 0x7e));
+          break;
+      }
+
+      packets.push_back(packet);
+    }
+
+    return packets;
+  }
+
+  // Send all packets and receive them from the same stream, 100 packets at a time.
+  void loopback(bool running, uint32_t* bytes) {
+    const std::vector<Packet> packets = traffic(20000);
+    LoopbackStream<1024>      stream;
+    SerialDevice              device(&stream);
+    device.begin();
+    device.setRunningStatus(running);
+
+    std::vector<Packet> received;
+    for (size_t i = 0; i < packets.size(); i += 100) {
+      const size_t n = std::min<size_t>(100, packets.size() - i);
+      CHECK(device.send(packets.data() + i, n) == n);
+
+      Packet buffer[128];
+      for (size_t r; (r = device.receive(buffer, 128)) > 0;)
+        received.insert(received.end(), buffer, buffer + r);
+    }
+
+    CHECK(received == packets);
+    CHECK(device.statistics.error == 0);
+    CHECK(device.statistics.dropped == 0);
+    CHECK(device.statistics.input.packet == packets.size());
+    CHECK(device.statistics.output.bytes == device.statistics.input.bytes);
+    *bytes = device.statistics.output.bytes;
+  }
+
+  void testLoopback() {
+    uint32_t plain;
+    uint32_t running;
+    loopback(false, &plain);
+    loopback(true, &running);
+    CHECK(running < plain);
+    printf("Loopback: %u bytes, %u with Running Status\n", plain, running);
+  }
+
+  void benchmarkLoopback() {
+    const std::vector<Packet> packets = traffic(64);
+    LoopbackStream<1024>      stream;
+    SerialDevice              device(&stream);
+    Transport*                transport = Test::opaque(static_cast<Transport*>(&device));
+    Packet                    buffer[64];
+
+    const double singleSeconds = Test::measure(20000, [&](uint32_t) {
+      transport->send(packets.data(), packets.size());
+      for (size_t n = 0; n < packets.size(); n++)
+        CHECK(transport->receive(buffer + n));
+    });
+    Test::report("loopback, receive(Packet*)", 20000.0 * packets.size(), singleSeconds, "packets");
+
+    const double batchSeconds = Test::measure(20000, [&](uint32_t) {
+      transport->send(packets.data(), packets.size());
+      CHECK(transport->receive(buffer, 64) == packets.size());
+    });
+    Test::report("loopback, receive(Packet*, size_t)", 20000.0 * packets.size(), batchSeconds, "packets");
+  }
+
+  // Wait until the file descriptor is readable.
+  void wait(int fd) {
+    struct pollfd p{fd, POLLIN, 0};
+    poll(&p, 1, -1);
+  }
+
+  // A writer thread and a reader over a pipe.
+  void testPipe() {
+    const std::vector<Packet> packets = traffic(200000);
+    int                       fds[2];
+    CHECK(pipe(fds) == 0);
+
+    FileStream   input(fds[0]);
+    FileStream   output(fds[1]);
+    SerialDevice receiver(&input);
+    SerialDevice sender(&output);
+    receiver.begin();
+    sender.begin();
+    sender.setRunningStatus(true);
+
+    const auto  start = std::chrono::steady_clock::now();
+    std::thread writer([&] {
+      for (size_t i = 0; i < packets.size(); i += 64)
+        sender.send(packets.data() + i, std::min<size_t>(64, packets.size() - i));
+    });
+
+    std::vector<Packet> received;
+    received.reserve(packets.size());
+    while (received.size() < packets.size()) {
+      wait(fds[0]);
+      Packet buffer[256];
+      for (size_t r; (r = receiver.receive(buffer, 256)) > 0;)
+        received.insert(received.end(), buffer, buffer + r);
+    }
+
+    const std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    writer.join();
+    close(fds[0]);
+    close(fds[1]);
+
+    CHECK(received == packets);
+    CHECK(receiver.statistics.error == 0);
+    Test::report("pipe, Running Status", packets.size(), seconds.count(), "packets");
+    printf("%-48s %10.2f bytes/packet\n", "", (double)sender.statistics.output.bytes / packets.size());
+  }
+
+  // Every packet is echoed by a second thread, the time until it is received back.
+  void testLatency() {
+    int to[2];
+    int from[2];
+    CHECK(pipe(to) == 0);
+    CHECK(pipe(from) == 0);
+
+    FileStream   toWrite(to[1]);
+    FileStream   toRead(to[0]);
+    FileStream   fromWrite(from[1]);
+    FileStream   fromRead(from[0]);
+    SerialDevice host(&toWrite);
+    SerialDevice hostInput(&fromRead);
+    SerialDevice echo(&toRead);
+    SerialDevice echoOutput(&fromWrite);
+
+    constexpr uint32_t count = 2000;
+    std::thread        echoer([&] {
+      for (uint32_t n = 0; n < count;) {
+        wait(to[0]);
+        Packet packet;
+        while (echo.receive(&packet)) {
+          CHECK(echoOutput.send(&packet));
+          n++;
+        }
+      }
+    });
+
+    std::vector<double> usec;
+    for (uint32_t i = 0; i < count; i++) {
+      Packet packet;
+      packet.setNote(0, i & 0x7f, 100);
+
+      const auto start = std::chrono::steady_clock::now();
+      CHECK(host.send(&packet));
+
+      Packet echoed;
+      do
+        wait(from[0]);
+      while (!hostInput.receive(&echoed));
+
+      const std::chrono::duration<double, std::micro> duration = std::chrono::steady_clock::now() - start;
+      usec.push_back(duration.count());
+      CHECK(echoed == packet);
+    }
+
+    echoer.join();
+    for (int fd : {to[0], to[1], from[0], from[1]})
+      close(fd);
+
+    std::sort(usec.begin(), usec.end());
+    printf("%-48s %10.2f us median, %.2f us 99th percentile\n",
+           "pipe, round-trip latency",
+           usec[count / 2],
+           usec[count * 99 / 100]);
+  }
+};
+
+int main() {
+  testLoopback();
+  benchmarkLoopback();
+  testPipe();
+  testLatency();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,205 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+// The serial byte stream parser: the bulk parse() compared with the parse() of
+// single bytes on random input, the packets of a valid stream, and the throughput.
+
+#include "test.h"
+#include <MIDI/SerialParser.h>
+#include <vector>
+
+using namespace V2MIDI;
+
+namespace {
+  // Random bytes, with more status bytes than in real traffic.
+  std::vector<uint8_t> noise(uint32_t length, uint32_t seed) {
+    std::vector<uint8_t> bytes(length);
+    Test::Random         random(seed);
+    for (uint8_t& b : bytes) {
+      const uint32_t r = random.next();
+      if (r % 5 == 0)
+        b = 0x80 | (r >> 8);
+      else if (r % 23 == 0)
+        b = static_cast<uint8_t>(Packet::Status::SystemExclusive);
+      else if (r % 29 == 0)
+        b = static_cast<uint8_t>(Packet::Status::SystemExclusiveEnd);
+      else
+        b = (r >> 8) & 0x7f;
+    }
+
+    return bytes;
+  }
+
+  struct Result {
+    std::vector<uint32_t> words;
+    uint32_t              error;
+    uint32_t              dropped;
+  };
+
+  Result parseBytes(const std::vector<uint8_t>& bytes) {
+    SerialParser parser;
+    Result       result{};
+    for (uint8_t b : bytes) {
+      Packet packet;
+      if (parser.parse(b, &packet))
+        result.words.push_back(packet.getWord());
+    }
+
+    result.error   = parser.statistics.error;
+    result.dropped = parser.statistics.dropped;
+    return result;
+  }
+
+  // Random pieces of the stream into random numbers of packets.
+  Result parseBulk(const std::vector<uint8_t>& bytes, uint32_t seed) {
+    SerialParser parser;
+    Test::Random random(seed);
+    Result       result{};
+    for (size_t i = 0; i < bytes.size();) {
+      size_t n = 1 + random.next() % 64;
+      if (n > bytes.size() - i)
+        n = bytes.size() - i;
+
+      Packet       packets[64];
+      const size_t max      = 1 + random.next() % 64;
+      size_t       consumed = 0;
+      const size_t count    = parser.parse(bytes.data() + i, n, packets, max, &consumed);
+      CHECK(count <= max);
+      CHECK(consumed <= n);
+      CHECK(consumed == n || count == max);
+
+      for (size_t p = 0; p < count; p++)
+        result.words.push_back(packets[p].getWord());
+
+      i += consumed;
+    }
+
+    result.error   = parser.statistics.error;
+    result.dropped = parser.statistics.dropped;
+    return result;
+  }
+
+  void testFuzz() {
+    for (uint32_t seed = 1; seed <= 200; seed++) {
+      const std::vector<uint8_t> bytes    = noise(4096, seed);
+      const Result               expected = parseBytes(bytes);
+      const Result               bulk     = parseBulk(bytes, seed);
+      CHECK(bulk.words == expected.words);
+      CHECK(bulk.error == expected.error);
+      CHECK(bulk.dropped == expected.dropped);
+
+      // Every packet is valid.
+      for (uint32_t word : expected.words) {
+        const Packet packet(word);
+        if (packet.getCodeIndex() >= Packet::CodeIndex::SystemExclusiveStart &&
+            packet.getCodeIndex() <= Packet::CodeIndex::SystemExclusiveEnd3)
+          continue;
+
+        CHECK(Packet::getCodeIndex(packet.getType()) == packet.getCodeIndex());
+      }
+    }
+  }
+
+  // Channel messages with Running Status, real-time messages in the middle of
+  // messages, and SysEx messages.
+  std::vector<uint8_t> traffic(uint32_t count, std::vector<uint32_t>* words) {
+    std::vector<uint8_t> bytes;
+    Test::Random         random(5);
+    uint8_t              running = 0;
+    for (uint32_t m = 0; m < count; m++) {
+      const uint32_t r = random.next();
+      Packet         packet;
+
+      if (r % 13 == 0) {
+        packet.set(0, Packet::Status::SystemClock);
+        bytes.push_back(packet.getByte(1));
+        words->push_back(packet.getWord());
+        continue;
+      }
+
+      if (r % 97 == 0) {
+        const uint8_t message[]{0xf0, 0x7d, 0x01, 0x02, 0x03, 0xf7};
+        bytes.insert(bytes.end(), message, message + sizeof(message));
+        words->push_back(0x017df004);
+        words->push_back(0xf7030207);
+        running = 0;
+        continue;
+      }
+
+      switch (r % 3) {
+        case 0:
+          packet.setNote(r >> 8 & 0x03, r >> 12 & 0x7f, r >> 20 & 0x7f);
+          break;
+
+        case 1:
+          packet.setControlChange(r >> 8 & 0x03, r >> 12 & 0x7f, r >> 20 & 0x7f);
+          break;
+
+        case 2:
+          packet.setProgram(r >> 8 & 0x03, r >> 12 & 0x7f);
+          break;
+      }
+
+      const uint8_t length = Packet::getLength(packet.getType());
+      if (packet.getByte(1) != running) {
+        running = packet.getByte(1);
+        bytes.push_back(running);
+      }
+
+      bytes.push_back(packet.getByte(2));
+
+      // A real-time message between the data bytes.
+      if (length == 3 && r >> 30 == 0) {
+        Packet clock;
+        clock.set(0, Packet::Status::SystemClock);
+        bytes.push_back(clock.getByte(1));
+        words->push_back(clock.getWord());
+      }
+
+      if (length == 3)
+        bytes.push_back(packet.getByte(3));
+
+      words->push_back(packet.getWord());
+    }
+
+    return bytes;
+  }
+
+  void testTraffic() {
+    std::vector<uint32_t>      words;
+    const std::vector<uint8_t> bytes  = traffic(10000, &words);
+    const Result               result = parseBulk(bytes, 1);
+    CHECK(result.words == words);
+    CHECK(result.error == 0);
+    CHECK(result.dropped == 0);
+  }
+
+  void benchmark() {
+    std::vector<uint32_t>      words;
+    const std::vector<uint8_t> bytes = traffic(100000, &words);
+    std::vector<Packet>        packets(bytes.size());
+
+    SerialParser  parser;
+    SerialParser* single = Test::opaque(&parser);
+    const double  byteSeconds = Test::measure(20, [&](uint32_t) {
+      size_t count = 0;
+      for (uint8_t b : bytes)
+        if (single->parse(b, packets.data() + count))
+          count++;
+      CHECK(count == words.size());
+    });
+    Test::report("parse(), one byte per call", bytes.size() * 20.0, byteSeconds, "bytes");
+
+    const double bulkSeconds = Test::measure(20, [&](uint32_t) {
+      CHECK(parser.parse(bytes.data(), bytes.size(), packets.data(), packets.size()) == words.size());
+    });
+    Test::report("parse(), buffer", bytes.size() * 20.0, bulkSeconds, "bytes");
+  }
+};
+
+int main() {
+  testFuzz();
+  testTraffic();
+  benchmark();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,467 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+// The bulk SysEx conversions compared with the previous conversion of one packet
+// per call, and the 7-bit codec compared with a byte at a time version.
+
+#include "test.h"
+#include <MIDI/Port.h>
+#include <MIDI/SysEx.h>
+#include <algorithm>
+#include <vector>
+
+using namespace V2MIDI;
+
+namespace {
+  // The previous packetizer, one packet per call with a switch on the remaining bytes.
+  Packet packetizeOne(const uint8_t* message, uint32_t length, uint32_t position, uint8_t port) {
+    uint8_t        data[4]{};
+    const uint32_t remain = length - position;
+    switch (remain) {
+      case 1:
+        data[0] = (port << 4) | static_cast<uint8_t>(Packet::CodeIndex::SystemExclusiveEnd1);
+        data[1] = message[position];
+        break;
+
+      case 2:
+        data[0] = (port << 4) | static_cast<uint8_t>(Packet::CodeIndex::SystemExclusiveEnd2);
+        data[1] = message[position];
+        data[2] = message[position + 1];
+        break;
+
+      case 3:
+        data[0] = (port << 4) | static_cast<uint8_t>(Packet::CodeIndex::SystemExclusiveEnd3);
+        data[1] = message[position];
+        data[2] = message[position + 1];
+        data[3] = message[position + 2];
+        break;
+
+      default:
+        data[0] = (port << 4) | static_cast<uint8_t>(Packet::CodeIndex::SystemExclusiveStart);
+        data[1] = message[position];
+        data[2] = message[position + 1];
+        data[3] = message[position + 2];
+        break;
+    }
+
+    Packet packet;
+    return *packet.setData(data);
+  }
+
+  std::vector<uint8_t> message(uint32_t length) {
+    std::vector<uint8_t> bytes(length);
+    Test::Random         random;
+    for (uint32_t i = 1; i + 1 < length; i++)
+      bytes[i] = random.next() & 0x7f;
+
+    bytes[0]          = static_cast<uint8_t>(Packet::Status::SystemExclusive);
+    bytes[length - 1] = static_cast<uint8_t>(Packet::Status::SystemExclusiveEnd);
+    return bytes;
+  }
+
+  // Every length, converted in one call and in pieces of every size.
+  void testPacketize() {
+    for (uint32_t length = 2; length < 100; length++) {
+      const std::vector<uint8_t> bytes = message(length);
+      const uint32_t             count = (length + 2) / 3;
+
+      std::vector<Packet> expected;
+      for (uint32_t position = 0; position < length; position += 3)
+        expected.push_back(packetizeOne(bytes.data(), length, position, 5));
+      CHECK(expected.size() == count);
+
+      for (uint32_t max = 1; max <= count + 1; max++) {
+        std::vector<Packet> packets(count + 1);
+        uint32_t            n = 0;
+        for (uint32_t r; (r = SysEx::packetize(bytes.data(), length, n * 3, 5, packets.data() + n, max)) > 0;) {
+          CHECK(r <= max);
+          n += r;
+        }
+
+        CHECK(n == count);
+        for (uint32_t i = 0; i < count; i++)
+          CHECK(packets[i] == expected[i]);
+      }
+    }
+  }
+
+  // Counts the packets, accepts every packet.
+  class Sink : public Transport {
+  public:
+    using Transport::receive;
+    using Transport::send;
+
+    bool receive(Packet* packet) {
+      return false;
+    }
+
+    bool send(Packet* packet) {
+      Test::use(*packet);
+      count++;
+      return true;
+    }
+
+    size_t send(const Packet* packets, size_t n) {
+      Test::use(packets[n - 1]);
+      count += n;
+      return n;
+    }
+
+    uint32_t count{};
+  };
+
+  void benchmarkPacketize() {
+    constexpr uint32_t         length = 65536;
+    const std::vector<uint8_t> bytes  = message(length);
+    std::vector<Packet>        packets((length + 2) / 3);
+
+    const double oneSeconds = Test::measure(100, [&](uint32_t) {
+      for (uint32_t position = 0, i = 0; position < length; position += 3, i++)
+        packets[i] = packetizeOne(bytes.data(), length, position, 0);
+      Test::use(packets[0]);
+    });
+    Test::report("packetize, one packet per call", length * 100.0, oneSeconds, "bytes");
+
+    const double bulkSeconds = Test::measure(100, [&](uint32_t) {
+      Test::use(SysEx::packetize(bytes.data(), length, 0, 0, packets.data(), packets.size()));
+    });
+    Test::report("packetize, bulk", length * 100.0, bulkSeconds, "bytes");
+
+    // The complete path through a port, loopSystemExclusive() sends one packet per
+    // call, sendSystemExclusive() batches of 16 packets.
+    Port port(0, length);
+    port.begin();
+    Sink       sink;
+    Transport* transport = Test::opaque(static_cast<Transport*>(&sink));
+
+    const double loopSeconds = Test::measure(100, [&](uint32_t) {
+      memcpy(port.getSystemExclusiveBuffer(), bytes.data(), length);
+      CHECK(port.queueSystemExclusive(transport, length));
+      while (port.loopSystemExclusive() > 0)
+        ;
+    });
+    Test::report("Port::loopSystemExclusive()", length * 100.0, loopSeconds, "bytes");
+
+    const double sendSeconds = Test::measure(100, [&](uint32_t) {
+      memcpy(port.getSystemExclusiveBuffer(), bytes.data(), length);
+      port.sendSystemExclusive(transport, length);
+      CHECK(!port.isSendingSystemExclusive());
+    });
+    Test::report("Port::sendSystemExclusive()", length * 100.0, sendSeconds, "bytes");
+
+    CHECK(sink.count == 1000 * packets.size());
+  }
+
+  // Records the received messages.
+  class Receiver : public BasicPort<Receiver> {
+  public:
+    Receiver(uint32_t size) : BasicPort(0, size) {}
+
+    std::vector<std::vector<uint8_t>> messages;
+    uint32_t                          clock{};
+    uint32_t                          note{};
+
+  private:
+    friend class BasicPort<Receiver>;
+
+    void handleSystemExclusive(const uint8_t* buffer, uint32_t len) {
+      messages.emplace_back(buffer, buffer + len);
+    }
+
+    void handleClock(Clock::Event event) {
+      clock++;
+    }
+
+    void handleNote(uint8_t channel, uint8_t note, uint8_t velocity) {
+      this->note++;
+    }
+  };
+
+  // Messages with clock ticks between their packets, notes which abort a message,
+  // and messages which do not fit into the buffer.
+  std::vector<Packet> stream(uint32_t count) {
+    std::vector<Packet> packets;
+    Test::Random        random(7);
+    for (uint32_t m = 0; m < count; m++) {
+      const uint32_t             length = 2 + random.next() % 300;
+      const std::vector<uint8_t> bytes  = message(length);
+      std::vector<Packet>        message((length + 2) / 3);
+      SysEx::packetize(bytes.data(), length, 0, 0, message.data(), message.size());
+
+      for (const Packet& packet : message) {
+        const uint32_t r = random.next();
+        Packet other;
+        if (r % 17 == 0)
+          packets.push_back(*other.set(0, Packet::Status::SystemClock));
+
+        if (r % 401 == 0)
+          packets.push_back(*other.setNote(0, 60, 100));
+
+        packets.push_back(packet);
+      }
+    }
+
+    return packets;
+  }
+
+  // The payload of every prefix of a data packet array, into every buffer size; the
+  // bytes past the buffer are not touched.
+  void testDepacketizeBuffer() {
+    const std::vector<uint8_t> bytes = message(64);
+    Packet                     packets[21];
+    SysEx::packetize(bytes.data(), 64, 0, 0, packets, 21);
+
+    // A data packet, a packet with a different code index, and the start of a message.
+    for (const uint32_t stop : {0x00605004u, 0x00605009u, 0x0060f004u}) {
+      for (uint32_t at = 1; at < 21; at++) {
+        Packet copy[21];
+        std::copy(packets, packets + 21, copy);
+        copy[at].setWord(stop);
+
+        for (uint32_t size = 0; size < 70; size++) {
+          uint8_t buffer[80];
+          memset(buffer, 0xaa, sizeof(buffer));
+          const uint32_t n = SysEx::depacketize(copy + 1, 20, buffer, size);
+
+          uint32_t expected = std::min<uint32_t>(size / 3, 20);
+          if ((stop & 0x0f) != 4 || (stop & 0xff00) == 0xf000)
+            expected = std::min<uint32_t>(expected, at - 1);
+          CHECK(n == expected);
+          CHECK(memcmp(buffer, bytes.data() + 3, std::min(n, at - 1) * 3) == 0);
+          for (uint32_t i = size; i < sizeof(buffer); i++)
+            CHECK(buffer[i] == 0xaa);
+        }
+      }
+    }
+  }
+
+  // The batched dispatch, in pieces of any size, delivers the same messages as
+  // the dispatch of single packets.
+  void testDepacketize() {
+    const std::vector<Packet> packets = stream(500);
+
+    Receiver single(256);
+    single.begin();
+    for (Packet packet : packets)
+      single.dispatch(NULL, &packet);
+
+    CHECK(single.messages.size() > 300);
+    CHECK(single.clock > 0);
+    CHECK(single.note > 0);
+
+    Receiver     batched(256);
+    Test::Random random(3);
+    batched.begin();
+    std::vector<Packet> copy = packets;
+    for (size_t i = 0; i < copy.size();) {
+      size_t n = 1 + random.next() % 40;
+      if (n > copy.size() - i)
+        n = copy.size() - i;
+
+      batched.dispatch(NULL, copy.data() + i, n);
+      i += n;
+    }
+
+    CHECK(batched.messages == single.messages);
+    CHECK(batched.clock == single.clock);
+    CHECK(batched.note == single.note);
+  }
+
+  // Only counts the received messages.
+  class Counter : public BasicPort<Counter> {
+  public:
+    Counter(uint32_t size) : BasicPort(0, size) {}
+
+    uint32_t       messages{};
+    const uint8_t* buffer{};
+    uint32_t       length{};
+
+  private:
+    friend class BasicPort<Counter>;
+
+    void handleSystemExclusive(const uint8_t* buffer, uint32_t len) {
+      messages++;
+      this->buffer = buffer;
+      length       = len;
+    }
+  };
+
+  void benchmarkDepacketize() {
+    constexpr uint32_t         length = 65536;
+    const std::vector<uint8_t> bytes  = message(length);
+    std::vector<Packet>        packets((length + 2) / 3);
+    SysEx::packetize(bytes.data(), length, 0, 0, packets.data(), packets.size());
+
+    Counter port(length);
+    port.begin();
+
+    // The dispatch modifies the last packet of a message, it is restored for every run.
+    std::vector<Packet> copy = packets;
+
+    auto single = [&](uint32_t) {
+      copy.back() = packets.back();
+      for (Packet& packet : copy)
+        port.dispatch(NULL, &packet);
+    };
+
+    // A USB full-speed endpoint buffer carries 16 packets.
+    auto batched = [&](uint32_t) {
+      copy.back() = packets.back();
+      for (size_t i = 0; i < copy.size(); i += 16)
+        port.dispatch(NULL, copy.data() + i, std::min<size_t>(16, copy.size() - i));
+    };
+
+    auto all = [&](uint32_t) {
+      copy.back() = packets.back();
+      port.dispatch(NULL, copy.data(), copy.size());
+    };
+
+    // Alternate the measurements, a slow period of the machine does not affect
+    // only one of them.
+    double singleSeconds  = 0;
+    double batchedSeconds = 0;
+    double allSeconds     = 0;
+    for (uint8_t round = 0; round < 3; round++) {
+      const double s = Test::measure(100, single);
+      const double b = Test::measure(100, batched);
+      const double a = Test::measure(100, all);
+      if (round == 0 || s < singleSeconds)
+        singleSeconds = s;
+      if (round == 0 || b < batchedSeconds)
+        batchedSeconds = b;
+      if (round == 0 || a < allSeconds)
+        allSeconds = a;
+    }
+
+    Test::report("dispatch, one packet per call", length * 100.0, singleSeconds, "bytes");
+    Test::report("dispatch, 16 packets per call", length * 100.0, batchedSeconds, "bytes");
+    Test::report("dispatch, all packets in one call", length * 100.0, allSeconds, "bytes");
+
+    CHECK(port.messages == 3 * 1500);
+    CHECK(port.length == length);
+    CHECK(memcmp(port.buffer, bytes.data(), length) == 0);
+
+#ifdef NDEBUG
+    // The target for a contiguous array is 4 times the bytes/s. A USB endpoint buffer
+    // of 16 packets adds the cost of the call and reaches a bit less than that.
+    CHECK(singleSeconds / allSeconds >= 4);
+    CHECK(singleSeconds / batchedSeconds >= 2);
+#endif
+  }
+
+  // The byte at a time version of the 7-bit encoding.
+  uint32_t encodeBytes(const uint8_t* data, uint32_t length, uint8_t* buffer) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < length; i += 7) {
+      const uint32_t header = n++;
+      buffer[header]        = 0;
+      for (uint32_t b = 0; b < 7 && i + b < length; b++) {
+        buffer[header] |= (data[i + b] >> 7) << b;
+        buffer[n++] = data[i + b] & 0x7f;
+      }
+    }
+
+    return n;
+  }
+
+  uint32_t decodeBytes(const uint8_t* data, uint32_t length, uint8_t* buffer) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < length; i += 8)
+      for (uint32_t b = 1; b < 8 && i + b < length; b++)
+        buffer[n++] = data[i + b] | ((data[i] >> (b - 1)) & 1) << 7;
+
+    return n;
+  }
+
+  // Every length, and the Encoder with pieces of every size.
+  void testCodec() {
+    Test::Random random(11);
+    for (uint32_t length = 0; length < 100; length++) {
+      std::vector<uint8_t> data(length);
+      for (uint8_t& b : data)
+        b = random.next();
+
+      const uint32_t       size = SysEx::getEncodedSize(length);
+      std::vector<uint8_t> expected(size + 1);
+      std::vector<uint8_t> encoded(size + 1);
+      CHECK(encodeBytes(data.data(), length, expected.data()) == size);
+      CHECK(SysEx::encode(data.data(), length, encoded.data()) == size);
+      CHECK(encoded == expected);
+      for (uint32_t i = 0; i < size; i++)
+        CHECK(encoded[i] < 0x80);
+
+      std::vector<uint8_t> decoded(length + 1);
+      CHECK(SysEx::getDecodedSize(size) == length);
+      CHECK(SysEx::decode(encoded.data(), size, decoded.data()) == length);
+      CHECK(std::equal(data.begin(), data.end(), decoded.begin()));
+
+      std::vector<uint8_t> reference(length + 1);
+      CHECK(decodeBytes(encoded.data(), size, reference.data()) == length);
+      CHECK(reference == decoded);
+
+      for (uint32_t piece = 1; piece <= length; piece++) {
+        std::vector<uint8_t> buffer(size);
+        SysEx::Encoder       encoder(buffer.data(), size);
+        for (uint32_t i = 0; i < length; i += piece)
+          CHECK(encoder.add(data.data() + i, std::min(piece, length - i)));
+
+        CHECK(encoder.getLength() == size);
+        CHECK(std::equal(buffer.begin(), buffer.end(), expected.begin()));
+
+        // The buffer is full.
+        CHECK(!encoder.add(data.data(), 1));
+      }
+    }
+  }
+
+  void benchmarkCodec() {
+    constexpr uint32_t   length = 65536;
+    std::vector<uint8_t> data(length);
+    std::vector<uint8_t> encoded(SysEx::getEncodedSize(length));
+    std::vector<uint8_t> decoded(length);
+    Test::Random         random;
+    for (uint8_t& b : data)
+      b = random.next();
+
+    const double bytesSeconds = Test::measure(100, [&](uint32_t) {
+      Test::use(encodeBytes(data.data(), length, encoded.data()));
+    });
+    Test::report("encode, byte at a time", length * 100.0, bytesSeconds, "bytes");
+
+    const double encodeSeconds = Test::measure(100, [&](uint32_t) {
+      Test::use(SysEx::encode(data.data(), length, encoded.data()));
+    });
+    Test::report("SysEx::encode()", length * 100.0, encodeSeconds, "bytes");
+
+    const double encoderSeconds = Test::measure(100, [&](uint32_t) {
+      SysEx::Encoder encoder(encoded.data(), encoded.size());
+      for (uint32_t i = 0; i < length; i += 100)
+        encoder.add(data.data() + i, std::min<uint32_t>(100, length - i));
+      Test::use(encoder.getLength());
+    });
+    Test::report("SysEx::Encoder, pieces of 100 bytes", length * 100.0, encoderSeconds, "bytes");
+
+    const double decodeBytesSeconds = Test::measure(100, [&](uint32_t) {
+      Test::use(decodeBytes(encoded.data(), encoded.size(), decoded.data()));
+    });
+    Test::report("decode, byte at a time", length * 100.0, decodeBytesSeconds, "bytes");
+
+    const double decodeSeconds = Test::measure(100, [&](uint32_t) {
+      Test::use(SysEx::decode(encoded.data(), encoded.size(), decoded.data()));
+    });
+    Test::report("SysEx::decode()", length * 100.0, decodeSeconds, "bytes");
+
+    CHECK(decoded == data);
+  }
+};
+
+int main() {
+  testPacketize();
+  benchmarkPacketize();
+  testDepacketizeBuffer();
+  testDepacketize();
+  benchmarkDepacketize();
+  testCodec();
+  benchmarkCodec();
+  return EXIT_SUCCESS;
+}
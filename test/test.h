@@ -0,0 +1,69 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+// A failed check prints its location and exits with an error.
+#define CHECK(expression)                                                                                    \
+  do {                                                                                                       \
+    if (!(expression)) {                                                                                     \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expression);                        \
+      exit(EXIT_FAILURE);                                                                                    \
+    }                                                                                                        \
+  } while (0)
+
+namespace Test {
+  // The number of seconds it takes to call 'f' 'n' times, the best of a few runs.
+  template <typename F> double measure(uint32_t n, F f) {
+    double best = 0;
+    for (uint8_t run = 0; run < 5; run++) {
+      const auto start = std::chrono::steady_clock::now();
+      for (uint32_t i = 0; i < n; i++)
+        f(i);
+
+      const std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+      if (run == 0 || seconds.count() < best)
+        best = seconds.count();
+    }
+
+    return best;
+  }
+
+  // Print the rate of 'count' items in 'seconds'.
+  inline void report(const char* name, double count, double seconds, const char* unit) {
+    printf("%-48s %10.2f M%s/s\n", name, count / seconds / 1e6, unit);
+  }
+
+  // Keep the compiler from removing the measured code.
+  template <typename T> inline void use(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+  }
+
+  // Hide the object behind the pointer from the compiler, virtual calls are not
+  // resolved at compile time.
+  template <typename T> inline T* opaque(T* pointer) {
+    asm volatile("" : "+r"(pointer));
+    return pointer;
+  }
+
+  // A deterministic pseudo-random sequence.
+  class Random {
+  public:
+    constexpr Random(uint32_t seed = 1) : _state(seed) {}
+
+    uint32_t next() {
+      _state ^= _state << 13;
+      _state ^= _state >> 17;
+      _state ^= _state << 5;
+      return _state;
+    }
+
+  private:
+    uint32_t _state;
+  };
+};
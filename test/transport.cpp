@@ -0,0 +1,187 @@
+// © Kay Sievers <kay@versioduo.com>, 2020-2023
+// SPDX-License-Identifier: Apache-2.0
+
+// Single and batched Transport calls; the batched calls need one virtual call
+// per endpoint buffer instead of one per packet.
+
+#include "test.h"
+#include <MIDI/Queue.h>
+#include <MIDI/SerialDevice.h>
+#include <MIDI/Transport.h>
+
+using namespace V2MIDI;
+
+namespace {
+  // A USB endpoint like buffer of 16 packets, with native batched calls.
+  class Endpoint : public Transport {
+  public:
+    bool receive(Packet* packet) {
+      if (_first == _count)
+        return false;
+
+      *packet = _packets[_first++];
+      return true;
+    }
+
+    size_t receive(Packet* packets, size_t max) {
+      size_t n = 0;
+      while (n < max && _first < _count)
+        packets[n++] = _packets[_first++];
+
+      return n;
+    }
+
+    bool send(Packet* packet) {
+      if (_count == 16)
+        return false;
+
+      _packets[_count++] = *packet;
+      return true;
+    }
+
+    size_t send(const Packet* packets, size_t count) {
+      size_t n = 0;
+      while (n < count && _count < 16)
+        _packets[_count++] = packets[n++];
+
+      return n;
+    }
+
+    void fill(uint32_t sequence) {
+      for (uint8_t i = 0; i < 16; i++)
+        _packets[i].setWord(sequence + i);
+
+      _first = 0;
+      _count = 16;
+    }
+
+    void clear() {
+      _first = 0;
+      _count = 0;
+    }
+
+    const Packet* getPackets() const {
+      return _packets;
+    }
+
+  private:
+    Packet  _packets[16];
+    uint8_t _first{};
+    uint8_t _count{};
+  };
+
+  // Only the single packet calls, the batched calls are the fallbacks of Transport.
+  class Minimal : public Transport {
+  public:
+    using Transport::receive;
+    using Transport::send;
+
+    bool receive(Packet* packet) {
+      return _endpoint.receive(packet);
+    }
+
+    bool send(Packet* packet) {
+      return _endpoint.send(packet);
+    }
+
+    Endpoint _endpoint;
+  };
+
+  void testOrder() {
+    Endpoint endpoint;
+    endpoint.fill(100);
+
+    Packet packets[32];
+    CHECK(endpoint.receive(packets, 5) == 5);
+    CHECK(endpoint.receive(packets + 5, 32) == 11);
+    for (uint8_t i = 0; i < 16; i++)
+      CHECK(packets[i].getWord() == 100u + i);
+
+    Minimal minimal;
+    minimal._endpoint.fill(200);
+    CHECK(minimal.receive(packets, 32) == 16);
+    CHECK(packets[15].getWord() == 215);
+
+    // A refused packet stops the fallback.
+    minimal._endpoint.clear();
+    CHECK(minimal.send(packets, 20) == 16);
+    CHECK(minimal._endpoint.getPackets()[15].getWord() == 215);
+  }
+
+  void testQueuedTransport() {
+    Minimal             minimal;
+    QueuedTransport<64> queued(&minimal);
+    Packet              packets[20];
+    for (uint8_t i = 0; i < 20; i++)
+      packets[i].setWord(i + 1);
+
+    // The batched calls are visible on the concrete type.
+    CHECK(queued.send(packets, 20) == 20);
+    queued.pollSend();
+    CHECK(minimal._endpoint.getPackets()[15].getWord() == 16);
+
+    minimal._endpoint.fill(300);
+    queued.pollReceive();
+    Packet received[32];
+    CHECK(queued.receive(received, 32) == 16);
+    CHECK(received[0].getWord() == 300);
+  }
+
+  void testSerialDevice() {
+    LoopbackStream<256> stream;
+    SerialDevice        device(&stream);
+
+    Packet packets[8];
+    for (uint8_t i = 0; i < 8; i++)
+      packets[i].setNote(i, 60 + i, 100);
+
+    CHECK(device.send(packets, 8) == 8);
+
+    Packet received[16];
+    CHECK(device.receive(received, 16) == 8);
+    for (uint8_t i = 0; i < 8; i++)
+      CHECK(received[i].getWord() == packets[i].getWord());
+  }
+
+  void benchmark() {
+    constexpr uint32_t n = 1000000;
+    Endpoint           endpoint;
+    Transport*         transport = &endpoint;
+    Packet             packets[16];
+
+    const double single = Test::measure(n, [&](uint32_t i) {
+      endpoint.fill(i);
+      Packet packet;
+      while (transport->receive(&packet))
+        Test::use(packet);
+    });
+    Test::report("receive(Packet*)", n * 16.0, single, "packets");
+
+    const double batched = Test::measure(n, [&](uint32_t i) {
+      endpoint.fill(i);
+      Test::use(transport->receive(packets, 16));
+    });
+    Test::report("receive(Packet*, size_t)", n * 16.0, batched, "packets");
+
+    const double sendSingle = Test::measure(n, [&](uint32_t i) {
+      endpoint.clear();
+      for (uint8_t p = 0; p < 16; p++)
+        transport->send(packets + p);
+    });
+    Test::report("send(Packet*)", n * 16.0, sendSingle, "packets");
+
+    const double sendBatched = Test::measure(n, [&](uint32_t i) {
+      endpoint.clear();
+      Test::use(transport->send(packets, 16));
+    });
+    Test::report("send(const Packet*, size_t)", n * 16.0, sendBatched, "packets");
+  }
+};
+
+int main() {
+  testOrder();
+  testQueuedTransport();
+  testSerialDevice();
+  benchmark();
+  return EXIT_SUCCESS;
+}